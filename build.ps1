@@ -1,4 +1,12 @@
-clang++ -o main.exe main.cpp -I./arena -I./raylib/include -L./raylib/lib -lraylib -luser32 -lshell32 -lgdi32 -lwinmm -fms-runtime-lib=libcmt -Xlinker /NODEFAULTLIB -lmsvcrt -lucrt -lvcruntime -lmsvcprt -lkernel32 -ggdb
+param([switch]$Profiler)
+
+# -Profiler builds in the profiling zones; the default build carries none.
+$defines = @()
+if ($Profiler) {
+	$defines += "-DPROFILER"
+}
+
+clang++ -o main.exe main.cpp -I./arena -I./raylib/include -L./raylib/lib -lraylib -luser32 -lshell32 -lgdi32 -lwinmm -fms-runtime-lib=libcmt -Xlinker /NODEFAULTLIB -lmsvcrt -lucrt -lvcruntime -lmsvcprt -lkernel32 -ggdb $defines
 
 if ($LastExitCode -eq 0) {
 	./main.exe
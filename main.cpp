@@ -1,12 +1,20 @@
 #include <algorithm>
+#include <atomic>
 #include <cassert>
+#include <chrono>
+#include <climits>
 #include <cmath>
 #include <cstddef>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
+#include <ctime>
+#include <condition_variable>
 #include <initializer_list>
+#include <mutex>
 #include <sys/stat.h>
+#include <thread>
 
 #define ARENA_IMPLEMENTATION
 #include <arena.h> 
@@ -15,9 +23,36 @@
 #define MAX_TEXT_BUFFER_LENGTH 4096
 #include <raylib.h>
 #include <raymath.h>
+#include <rlgl.h>
 #if defined(PLATFORM_WEB)
 #include <emscripten/emscripten.h>
 #endif
+#if defined(__SSE2__)
+#include <immintrin.h>
+#endif
+#if defined(_WIN32) && !defined(PLATFORM_WEB)
+// windows.h clashes with raylib's names, so the file-mapping calls
+// map_file needs are declared here.
+extern "C" {
+	__declspec(dllimport) void* __stdcall CreateFileA(const char* name, unsigned long access, unsigned long share, void* security, unsigned long disposition, unsigned long flags, void* template_file);
+	__declspec(dllimport) void* __stdcall CreateFileMappingA(void* file, void* security, unsigned long protect, unsigned long size_high, unsigned long size_low, const char* name);
+	__declspec(dllimport) void* __stdcall MapViewOfFile(void* mapping, unsigned long access, unsigned long offset_high, unsigned long offset_low, size_t size);
+	__declspec(dllimport) int __stdcall UnmapViewOfFile(const void* base);
+	__declspec(dllimport) unsigned long __stdcall GetFileSize(void* file, unsigned long* size_high);
+	__declspec(dllimport) int __stdcall CloseHandle(void* handle);
+}
+#define GENERIC_READ 0x80000000ul
+#define FILE_SHARE_READ 0x1ul
+#define OPEN_EXISTING 3ul
+#define FILE_ATTRIBUTE_NORMAL 0x80ul
+#define PAGE_READONLY 0x2ul
+#define FILE_MAP_READ 0x4ul
+#define INVALID_HANDLE_VALUE ((void*)(intptr_t)-1)
+#elif !defined(PLATFORM_WEB)
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#endif
 
 // :sprite
 const Vector4 PLAYER = {1008, 1008, 16, 16};
@@ -179,8 +214,314 @@ const Vector2 v2_floor(const Vector2& a) {
 	return {floorf(a.x), floorf(a.y)};
 }
 
+// :move_towards
+// Vector2MoveTowards over arrays: pos[i] steps towards target[i] by at most
+// max_dist[i], and bit i of arrived is set when the new pos passes
+// Vector2Equals with the target. Every path does the same operations in the
+// same order as raymath, so all of them give bit-identical results. AVX2 is used when the build enables
+// it (-mavx2), SSE2 on any other x86-64 build, scalar everywhere else.
+inline bool move_towards_one(Vector2* pos, Vector2 target, float max_dist) {
+	float dx = target.x - pos->x;
+	float dy = target.y - pos->y;
+	float value = dx * dx + dy * dy;
+	if (value == 0 || (max_dist >= 0 && value <= max_dist * max_dist)) {
+		*pos = target;
+		return true;
+	}
+	float dist = sqrtf(value);
+	pos->x = pos->x + dx / dist * max_dist;
+	pos->y = pos->y + dy / dist * max_dist;
+	return Vector2Equals(*pos, target);
+}
+
+// Returns how many leading entries were handled; the rest go through
+// move_towards_one.
+#if defined(__AVX2__)
+#define MOVE_TOWARDS_PATH "avx2"
+int move_towards_simd(Vector2* pos, const Vector2* target, const float* max_dist, int count, uint64_t* arrived) {
+	__m256 zero = _mm256_setzero_ps();
+	int i = 0;
+	for (; i + 8 <= count; i += 8) {
+		// Deinterleaving within 128-bit lanes leaves entries in the order
+		// 0 1 4 5 2 3 6 7; max_dist is permuted to match and the mask remapped.
+		__m256 p0 = _mm256_loadu_ps(&pos[i].x);
+		__m256 p1 = _mm256_loadu_ps(&pos[i + 4].x);
+		__m256 t0 = _mm256_loadu_ps(&target[i].x);
+		__m256 t1 = _mm256_loadu_ps(&target[i + 4].x);
+		__m256 px = _mm256_shuffle_ps(p0, p1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 py = _mm256_shuffle_ps(p0, p1, _MM_SHUFFLE(3, 1, 3, 1));
+		__m256 tx = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m256 ty = _mm256_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1));
+		__m256 max = _mm256_castpd_ps(_mm256_permute4x64_pd(
+			_mm256_castps_pd(_mm256_loadu_ps(&max_dist[i])), _MM_SHUFFLE(3, 1, 2, 0)));
+
+		__m256 dx = _mm256_sub_ps(tx, px);
+		__m256 dy = _mm256_sub_ps(ty, py);
+		__m256 value = _mm256_add_ps(_mm256_mul_ps(dx, dx), _mm256_mul_ps(dy, dy));
+		__m256 snap = _mm256_or_ps(
+			_mm256_cmp_ps(value, zero, _CMP_EQ_OQ),
+			_mm256_and_ps(
+				_mm256_cmp_ps(max, zero, _CMP_GE_OQ),
+				_mm256_cmp_ps(value, _mm256_mul_ps(max, max), _CMP_LE_OQ)));
+		__m256 dist = _mm256_sqrt_ps(value);
+		__m256 nx = _mm256_add_ps(px, _mm256_mul_ps(_mm256_div_ps(dx, dist), max));
+		__m256 ny = _mm256_add_ps(py, _mm256_mul_ps(_mm256_div_ps(dy, dist), max));
+		nx = _mm256_blendv_ps(nx, tx, snap);
+		ny = _mm256_blendv_ps(ny, ty, snap);
+
+		// Vector2Equals(new pos, target).
+		__m256 sign = _mm256_set1_ps(-0.f);
+		__m256 one = _mm256_set1_ps(1.f);
+		__m256 eps = _mm256_set1_ps(EPSILON);
+		__m256 scale_x = _mm256_max_ps(one, _mm256_max_ps(_mm256_andnot_ps(sign, nx), _mm256_andnot_ps(sign, tx)));
+		__m256 scale_y = _mm256_max_ps(one, _mm256_max_ps(_mm256_andnot_ps(sign, ny), _mm256_andnot_ps(sign, ty)));
+		__m256 equal = _mm256_and_ps(
+			_mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(nx, tx)), _mm256_mul_ps(eps, scale_x), _CMP_LE_OQ),
+			_mm256_cmp_ps(_mm256_andnot_ps(sign, _mm256_sub_ps(ny, ty)), _mm256_mul_ps(eps, scale_y), _CMP_LE_OQ));
+
+		_mm256_storeu_ps(&pos[i].x, _mm256_unpacklo_ps(nx, ny));
+		_mm256_storeu_ps(&pos[i + 4].x, _mm256_unpackhi_ps(nx, ny));
+		unsigned mask = _mm256_movemask_ps(equal);
+		mask = (mask & 0xC3) | ((mask & 0x0C) << 2) | ((mask & 0x30) >> 2);
+		arrived[i >> 6] |= uint64_t(mask) << (i & 63);
+	}
+	return i;
+}
+#elif defined(__SSE2__)
+#define MOVE_TOWARDS_PATH "sse2"
+int move_towards_simd(Vector2* pos, const Vector2* target, const float* max_dist, int count, uint64_t* arrived) {
+	__m128 zero = _mm_setzero_ps();
+	int i = 0;
+	for (; i + 4 <= count; i += 4) {
+		__m128 p0 = _mm_loadu_ps(&pos[i].x);
+		__m128 p1 = _mm_loadu_ps(&pos[i + 2].x);
+		__m128 t0 = _mm_loadu_ps(&target[i].x);
+		__m128 t1 = _mm_loadu_ps(&target[i + 2].x);
+		__m128 px = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 py = _mm_shuffle_ps(p0, p1, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 tx = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(2, 0, 2, 0));
+		__m128 ty = _mm_shuffle_ps(t0, t1, _MM_SHUFFLE(3, 1, 3, 1));
+		__m128 max = _mm_loadu_ps(&max_dist[i]);
+
+		__m128 dx = _mm_sub_ps(tx, px);
+		__m128 dy = _mm_sub_ps(ty, py);
+		__m128 value = _mm_add_ps(_mm_mul_ps(dx, dx), _mm_mul_ps(dy, dy));
+		__m128 snap = _mm_or_ps(
+			_mm_cmpeq_ps(value, zero),
+			_mm_and_ps(_mm_cmpge_ps(max, zero), _mm_cmple_ps(value, _mm_mul_ps(max, max))));
+		__m128 dist = _mm_sqrt_ps(value);
+		__m128 nx = _mm_add_ps(px, _mm_mul_ps(_mm_div_ps(dx, dist), max));
+		__m128 ny = _mm_add_ps(py, _mm_mul_ps(_mm_div_ps(dy, dist), max));
+		nx = _mm_or_ps(_mm_and_ps(snap, tx), _mm_andnot_ps(snap, nx));
+		ny = _mm_or_ps(_mm_and_ps(snap, ty), _mm_andnot_ps(snap, ny));
+
+		// Vector2Equals(new pos, target).
+		__m128 sign = _mm_set1_ps(-0.f);
+		__m128 one = _mm_set1_ps(1.f);
+		__m128 eps = _mm_set1_ps(EPSILON);
+		__m128 scale_x = _mm_max_ps(one, _mm_max_ps(_mm_andnot_ps(sign, nx), _mm_andnot_ps(sign, tx)));
+		__m128 scale_y = _mm_max_ps(one, _mm_max_ps(_mm_andnot_ps(sign, ny), _mm_andnot_ps(sign, ty)));
+		__m128 equal = _mm_and_ps(
+			_mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(nx, tx)), _mm_mul_ps(eps, scale_x)),
+			_mm_cmple_ps(_mm_andnot_ps(sign, _mm_sub_ps(ny, ty)), _mm_mul_ps(eps, scale_y)));
+
+		_mm_storeu_ps(&pos[i].x, _mm_unpacklo_ps(nx, ny));
+		_mm_storeu_ps(&pos[i + 2].x, _mm_unpackhi_ps(nx, ny));
+		arrived[i >> 6] |= uint64_t(_mm_movemask_ps(equal)) << (i & 63);
+	}
+	return i;
+}
+#else
+#define MOVE_TOWARDS_PATH "scalar"
+int move_towards_simd(Vector2* pos, const Vector2* target, const float* max_dist, int count, uint64_t* arrived) {
+	return 0;
+}
+#endif
+
+// arrived needs room for count bits; it is cleared first.
+void move_towards_batch(Vector2* pos, const Vector2* target, const float* max_dist, int count, uint64_t* arrived) {
+	memset(arrived, 0, sizeof(uint64_t) * ((count + 63) / 64));
+	int i = move_towards_simd(pos, target, max_dist, count, arrived);
+	for (; i < count; i++) {
+		if (move_towards_one(&pos[i], target[i], max_dist[i])) {
+			arrived[i >> 6] |= 1ull << (i & 63);
+		}
+	}
+}
+// ;move_towards
+
 const Vector2 WINDOW_SIZE = v2(1280, 720);
 const Vector2 RENDER_SIZE = v2(640, 360);
+// Random flower and defense positions are rolled inside the render area.
+const Vector4 SPAWN_AREA = {-RENDER_SIZE.x / 2, -RENDER_SIZE.y / 2, RENDER_SIZE.x, RENDER_SIZE.y};
+
+// :profiler
+// Scoped CPU timers, compiled in with -DPROFILER (build.ps1 does). Zones are
+// recorded into a ring of the last PROFILE_FRAMES frames; F3 toggles an
+// overlay of per-zone averages and F4 writes the ring to profile.json in
+// Chrome's trace-event format (chrome://tracing, ui.perfetto.dev). Without
+// PROFILER every macro expands to nothing.
+#ifdef PROFILER
+#define PROFILE_FRAMES 120
+#define PROFILE_EVENTS 256
+
+struct ProfileEvent {
+	const char* name;
+	// Nanoseconds since the profiler started.
+	int64_t start;
+	int64_t dur;
+	int depth;
+	// Passes summed into a merged zone's event.
+	int calls;
+	bool merged;
+};
+
+struct ProfileFrame {
+	ProfileEvent events[PROFILE_EVENTS];
+	int count;
+};
+
+// Where a merged zone's event for the current frame is.
+struct ProfileSite {
+	int frame;
+	int event;
+};
+
+struct Profiler {
+	ProfileFrame frames[PROFILE_FRAMES];
+	// Frames begun so far; the one being recorded is frames[frame % PROFILE_FRAMES].
+	int frame;
+	int depth;
+	int64_t epoch;
+	bool show;
+};
+
+Profiler profiler = {};
+
+int64_t profile_now() {
+	return std::chrono::duration_cast<std::chrono::nanoseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+ProfileFrame* profile_frame(int frame) {
+	return &profiler.frames[frame % PROFILE_FRAMES];
+}
+
+void profile_begin_frame() {
+	if (profiler.epoch == 0) profiler.epoch = profile_now();
+	profiler.frame += 1;
+	profile_frame(profiler.frame)->count = 0;
+	profiler.depth = 0;
+}
+
+struct ProfileZone {
+	const char* name;
+	ProfileSite* site;
+	int64_t start;
+
+	ProfileZone(const char* name, ProfileSite* site = nullptr) : name(name), site(site) {
+		profiler.depth += 1;
+		start = profile_now();
+	}
+
+	~ProfileZone() {
+		int64_t end = profile_now();
+		profiler.depth -= 1;
+		ProfileFrame* frame = profile_frame(profiler.frame);
+		if (site && site->frame == profiler.frame) {
+			ProfileEvent* event = &frame->events[site->event];
+			event->dur += end - start;
+			event->calls += 1;
+			return;
+		}
+		if (frame->count == PROFILE_EVENTS) return;
+		if (site) *site = {profiler.frame, frame->count};
+		frame->events[frame->count++] = {name, start - profiler.epoch, end - start, profiler.depth, 1, site != nullptr};
+	}
+};
+
+bool profile_event_before(const ProfileEvent& a, const ProfileEvent& b) {
+	return a.start < b.start;
+}
+
+// Averages every zone of the last finished frame over the whole ring.
+void profile_draw_overlay() {
+	int frames = std::min(profiler.frame - 1, PROFILE_FRAMES - 1);
+	if (frames <= 0) return;
+
+	static ProfileEvent rows[PROFILE_EVENTS];
+	ProfileFrame* last = profile_frame(profiler.frame - 1);
+	int row_count = last->count;
+	memcpy(rows, last->events, sizeof(ProfileEvent) * row_count);
+	std::sort(rows, rows + row_count, profile_event_before);
+
+	int x = GetScreenWidth() - 310;
+	int y = 10;
+	DrawRectangle(x - 10, 0, 320, 20 + row_count * 12, ColorAlpha(BLACK, .7f));
+	for (int r = 0; r < row_count; r++) {
+		int64_t total = 0;
+		int calls = 0;
+		for (int f = 1; f <= frames; f++) {
+			ProfileFrame* frame = profile_frame(profiler.frame - f);
+			for (int e = 0; e < frame->count; e++) {
+				ProfileEvent* event = &frame->events[e];
+				if (event->name == rows[r].name && event->depth == rows[r].depth) {
+					total += event->dur;
+					calls += event->calls;
+				}
+			}
+		}
+		DrawText(TextFormat("%*s%s", rows[r].depth * 2, "", rows[r].name), x, y, 10, WHITE);
+		DrawText(TextFormat("%7.3f ms  x%d", total / 1e6 / frames, calls / frames), x + 190, y, 10, WHITE);
+		y += 12;
+	}
+}
+
+void profile_export(const char* path) {
+	FILE* f = fopen(path, "w");
+	if (!f) {
+		TraceLog(LOG_WARNING, "Failed to write %s", path);
+		return;
+	}
+	fprintf(f, "{\"traceEvents\": [\n");
+	fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 0, \"args\": {\"name\": \"zones\"}},\n");
+	fprintf(f, "{\"name\": \"thread_name\", \"ph\": \"M\", \"pid\": 0, \"tid\": 1, \"args\": {\"name\": \"merged zones\"}}");
+	int first = std::max(1, profiler.frame - PROFILE_FRAMES + 1);
+	for (int i = first; i < profiler.frame; i++) {
+		ProfileFrame* frame = profile_frame(i);
+		for (int e = 0; e < frame->count; e++) {
+			ProfileEvent* event = &frame->events[e];
+			fprintf(f, ",\n{\"name\": \"%s\", \"ph\": \"X\", \"pid\": 0, \"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"calls\": %d}}",
+				event->name, event->merged ? 1 : 0, event->start / 1e3, event->dur / 1e3, event->calls);
+		}
+	}
+	fprintf(f, "\n]}\n");
+	fclose(f);
+	TraceLog(LOG_INFO, "Wrote %s", path);
+}
+
+void profile_overlay() {
+	if (IsKeyPressed(KEY_F3)) profiler.show = !profiler.show;
+	if (IsKeyPressed(KEY_F4)) profile_export("profile.json");
+	if (profiler.show) profile_draw_overlay();
+}
+
+#define PROFILE_CONCAT_(a, b) a##b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT_(a, b)
+#define PROFILE_ZONE(name) ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name)
+// One event per frame summing every pass, for zones hit per tick or per entity.
+#define PROFILE_ZONE_MERGED(name) \
+	static ProfileSite PROFILE_CONCAT(profile_site_, __LINE__) = {-1, 0}; \
+	ProfileZone PROFILE_CONCAT(profile_zone_, __LINE__)(name, &PROFILE_CONCAT(profile_site_, __LINE__))
+#define PROFILE_FRAME() profile_begin_frame()
+#define PROFILE_OVERLAY() profile_overlay()
+#else
+#define PROFILE_ZONE(name)
+#define PROFILE_ZONE_MERGED(name)
+#define PROFILE_FRAME()
+#define PROFILE_OVERLAY()
+#endif
+// ;profiler
 
 // :renderer
 typedef enum DrawObjType {
@@ -192,15 +533,18 @@ typedef enum DrawObjType {
 	DRAW_OBJ_TEXT,
 } DrawObjType;
 
+struct TextRun;
+
 struct DrawObj {
+	// Sort key, see renderer_add.
+	uint64_t key;
 	DrawObjType type;
 	Vector4 src;
 	Vector4 dest;
 	Color tint;
 	float line_tick;
 	Texture2D tex;
-	const char* text;
-	float text_size;
+	TextRun* run;
 };
 
 struct ListDrawObj {
@@ -209,10 +553,6 @@ struct ListDrawObj {
 	int count;
 };
 
-struct RenderLayer {
-	ListDrawObj objs;
-};
-
 struct FIFO {
 	int* items;
 	int count;
@@ -229,28 +569,315 @@ void fifo_push(FIFO* fifo, int val) {
 	arena_da_append(&temp_arena, fifo, val);
 }
 
+// :batch
+// CPU side of the sprite batcher: DRAW_OBJ_TEXTURE quads are expanded into a
+// vertex stream with UVs already normalised to the texture, so submitting is
+// a straight copy into rlgl. Indices are implied by RL_QUADS (rlgl's batch
+// owns the index buffer).
+struct SpriteVertex {
+	float x, y;
+	float u, v;
+	Color color;
+};
+
+struct SpriteBatch {
+	SpriteVertex* items;
+	int count;
+	int capacity;
+	Texture2D tex;
+};
+
+void batch_push_quad(SpriteBatch* batch, Vector4 src, Vector4 dest, Color tint) {
+	float tw = float(batch->tex.width);
+	float th = float(batch->tex.height);
+	float u0 = src.x / tw;
+	float v0 = src.y / th;
+	float u1 = (src.x + fabsf(src.z)) / tw;
+	float v1 = (src.y + fabsf(src.w)) / th;
+	// Negative source sizes flip, same as DrawTextureRec.
+	if (src.z < 0) std::swap(u0, u1);
+	if (src.w < 0) std::swap(v0, v1);
+
+	float x = dest.x;
+	float y = dest.y;
+	float w = dest.z;
+	float h = dest.w;
+	// Same winding as raylib: top-left, bottom-left, bottom-right, top-right.
+	arena_da_append(&arena, batch, (SpriteVertex{x, y, u0, v0, tint}));
+	arena_da_append(&arena, batch, (SpriteVertex{x, y + h, u0, v1, tint}));
+	arena_da_append(&arena, batch, (SpriteVertex{x + w, y + h, u1, v1, tint}));
+	arena_da_append(&arena, batch, (SpriteVertex{x + w, y, u1, v0, tint}));
+}
+
+// :text_cache
+// Widths and glyph layouts of draw_text/measure_text strings, keyed by
+// (FNV-1a hash of the string, size). UI text barely changes between frames,
+// so the font's glyph table is walked once per distinct string instead of on
+// every measure and draw. Open addressing with linear probing; 64-bit hash
+// collisions are ignored.
+#define TEXT_CACHE_SIZE 1024
+// raylib 5.0's default, used for '\n' in DrawTextEx.
+#define TEXT_LINE_SPACING 15
+#define TEXT_DEFAULT_SIZE 10
+
+struct TextGlyph {
+	Vector4 src;
+	// Relative to the text origin.
+	Vector4 dest;
+};
+
+struct TextRun {
+	uint64_t hash;
+	// 0 marks an empty slot.
+	int size;
+	int width;
+	TextGlyph* glyphs;
+	int glyph_count;
+};
+
+struct TextCache {
+	TextRun slots[TEXT_CACHE_SIZE];
+	int count;
+	unsigned font_id;
+	// Glyph storage, reset with the table.
+	Arena arena;
+};
+
+TextCache text_cache = {};
+
+uint64_t text_hash(const char* text, int size) {
+	uint64_t hash = 14695981039346656037ull;
+	for (const char* c = text; *c; c++) {
+		hash = (hash ^ (unsigned char)*c) * 1099511628211ull;
+	}
+	return (hash ^ (unsigned)size) * 1099511628211ull;
+}
+
+void text_cache_clear() {
+	memset(text_cache.slots, 0, sizeof(text_cache.slots));
+	text_cache.count = 0;
+	arena_reset(&text_cache.arena);
+}
+
+// Queued DrawObjs point into the cache, so it is only dropped between frames:
+// when the default font changed or the table is getting crowded.
+void text_cache_begin_frame() {
+	unsigned font_id = GetFontDefault().texture.id;
+	if (font_id != text_cache.font_id || text_cache.count > TEXT_CACHE_SIZE / 2) {
+		text_cache_clear();
+		text_cache.font_id = font_id;
+	}
+}
+
+// Same placement as DrawText -> DrawTextEx -> DrawTextCodepoint.
+void text_layout(TextRun* run, const char* text, Arena* a) {
+	Font font = GetFontDefault();
+	int size = run->size;
+	float spacing = float(size / TEXT_DEFAULT_SIZE);
+	float scale = float(size) / font.baseSize;
+	float pad = float(font.glyphPadding);
+	int len = TextLength(text);
+
+	run->width = MeasureText(text, size);
+	run->glyphs = (TextGlyph*)arena_alloc(a, sizeof(TextGlyph) * std::max(len, 1));
+	run->glyph_count = 0;
+
+	float x = 0;
+	float y = 0;
+	for (int i = 0; i < len;) {
+		int bytes = 0;
+		int codepoint = GetCodepointNext(&text[i], &bytes);
+		int index = GetGlyphIndex(font, codepoint);
+		i += bytes;
+		if (codepoint == '\n') {
+			y += size + TEXT_LINE_SPACING;
+			x = 0;
+			continue;
+		}
+
+		Rectangle rec = font.recs[index];
+		GlyphInfo glyph = font.glyphs[index];
+		if (codepoint != ' ' && codepoint != '\t') {
+			run->glyphs[run->glyph_count++] = {
+				.src = v4(rec.x - pad, rec.y - pad, rec.width + 2 * pad, rec.height + 2 * pad),
+				.dest = v4(
+					x + (glyph.offsetX - pad) * scale,
+					y + (glyph.offsetY - pad) * scale,
+					(rec.width + 2 * pad) * scale,
+					(rec.height + 2 * pad) * scale),
+			};
+		}
+		float advance = glyph.advanceX == 0 ? rec.width : float(glyph.advanceX);
+		x += advance * scale + spacing;
+	}
+}
+
+TextRun* text_run(const char* text, int size) {
+	size = std::max(size, TEXT_DEFAULT_SIZE);
+	uint64_t hash = text_hash(text, size);
+	unsigned mask = TEXT_CACHE_SIZE - 1;
+	for (unsigned i = unsigned(hash) & mask;; i = (i + 1) & mask) {
+		TextRun* run = &text_cache.slots[i];
+		if (run->size == size && run->hash == hash) return run;
+		if (run->size != 0) continue;
+
+		// Full mid-frame: lay out uncached, valid until temp_arena resets.
+		if (text_cache.count == TEXT_CACHE_SIZE - 1) {
+			run = (TextRun*)arena_alloc(&temp_arena, sizeof(TextRun));
+			*run = {.hash = hash, .size = size};
+			text_layout(run, text, &temp_arena);
+			return run;
+		}
+		run->hash = hash;
+		run->size = size;
+		text_layout(run, text, &text_cache.arena);
+		text_cache.count += 1;
+		return run;
+	}
+}
+
+// Cached MeasureText.
+int measure_text(const char* text, int size) {
+	return text_run(text, size)->width;
+}
+
+struct RenderStats {
+	// Submissions to raylib: one per batch plus one per unbatched DrawObj.
+	int submissions;
+	// rlgl merges consecutive submissions on one texture into a single GPU
+	// draw, so texture changes are the draws that reach the GPU (short of
+	// rlgl's own flushes when its buffer fills).
+	int texture_switches;
+	unsigned int last_texture;
+	int sprites;
+};
+
+// :sort_key
+// Every DrawObj gets a 64-bit key, most significant field first:
+//   layer (10) | depth (16) | texture (14) | sequence (24)
+// Sequence is the DrawObj's index in the queue, so ties keep submission
+// order and the sorted keys double as indices back into the queue.
 #define MAX_LAYERS 1024
+#define KEY_SEQ_BITS 24
+#define KEY_TEX_BITS 14
+#define KEY_DEPTH_BITS 16
+#define KEY_SEQ_MASK ((1ull << KEY_SEQ_BITS) - 1)
+#define KEY_TEX_SHIFT KEY_SEQ_BITS
+#define KEY_DEPTH_SHIFT (KEY_TEX_SHIFT + KEY_TEX_BITS)
+#define KEY_LAYER_SHIFT (KEY_DEPTH_SHIFT + KEY_DEPTH_BITS)
+
 struct Renderer {
-	RenderLayer layers[MAX_LAYERS];	
+	ListDrawObj queue;
+	uint64_t* keys;
+	uint64_t* keys_tmp;
+	int keys_capacity;
+	// Layers whose objects may be reordered by texture within a depth.
+	uint64_t group_textures[MAX_LAYERS / 64];
 	Texture2D atlas;
+	SpriteBatch batch;
+	// Glyph quads against the default font's texture.
+	SpriteBatch text_batch;
+	RenderStats stats;
 	int current_layer;
+	int current_depth;
 	FIFO layer_stack;
 };
 
 Renderer* renderer = NULL;
 
-void push_layer(int layer) {
+void stats_submit(unsigned int texture) {
+	renderer->stats.submissions += 1;
+	if (texture != renderer->stats.last_texture) {
+		renderer->stats.texture_switches += 1;
+		renderer->stats.last_texture = texture;
+	}
+}
+
+// Maps a world y to a depth key: higher on screen draws first.
+int y_depth(float y) {
+	return (int)Clamp(y + (1 << (KEY_DEPTH_BITS - 1)), 0, (1 << KEY_DEPTH_BITS) - 1);
+}
+
+void push_layer(int layer, int depth = 0) {
 	fifo_push(&renderer->layer_stack, renderer->current_layer);
+	fifo_push(&renderer->layer_stack, renderer->current_depth);
 	renderer->current_layer = layer;
+	renderer->current_depth = depth;
 }
 
 void pop_layer() {
+	renderer->current_depth = fifo_pop(&renderer->layer_stack);
 	renderer->current_layer = fifo_pop(&renderer->layer_stack);
 }
 
+void group_layer_textures(int layer) {
+	renderer->group_textures[layer >> 6] |= 1ull << (layer & 63);
+}
+
+unsigned draw_obj_texture(DrawObj* obj) {
+	switch (obj->type) {
+		case DRAW_OBJ_TEXTURE:
+			return renderer->atlas.id;
+		case DRAW_OBJ_TEXTURE_PRO:
+			return obj->tex.id;
+		case DRAW_OBJ_TEXT:
+			return GetFontDefault().texture.id;
+		default:
+			return 0;
+	}
+}
+
 void renderer_add(DrawObj obj) {
-	RenderLayer *layer = &renderer->layers[renderer->current_layer];
-	arena_da_append(&arena, &layer->objs, obj);
+	int layer = renderer->current_layer;
+	uint64_t seq = uint64_t(renderer->queue.count);
+	assert(seq <= KEY_SEQ_MASK && "too many draws in one flush");
+
+	uint64_t tex = 0;
+	if (renderer->group_textures[layer >> 6] & (1ull << (layer & 63))) {
+		tex = draw_obj_texture(&obj) & ((1u << KEY_TEX_BITS) - 1);
+	}
+	obj.key = uint64_t(layer) << KEY_LAYER_SHIFT
+		| uint64_t(renderer->current_depth) << KEY_DEPTH_SHIFT
+		| tex << KEY_TEX_SHIFT
+		| seq;
+	arena_da_append(&arena, &renderer->queue, obj);
+}
+
+// LSD radix sort, a byte per pass. The queue is already in sequence order,
+// so the sequence bytes are skipped, as is any byte equal across all keys.
+// All byte histograms are gathered in one read up front.
+#define RADIX_PASSES ((64 - KEY_SEQ_BITS + 7) / 8)
+void radix_sort_keys(uint64_t* keys, uint64_t* tmp, int count) {
+	static int counts[RADIX_PASSES][256];
+	memset(counts, 0, sizeof(counts));
+	for (int i = 0; i < count; i++) {
+		uint64_t key = keys[i] >> KEY_SEQ_BITS;
+		for (int pass = 0; pass < RADIX_PASSES; pass++) {
+			counts[pass][(key >> (pass * 8)) & 0xFF] += 1;
+		}
+	}
+
+	uint64_t* src = keys;
+	uint64_t* dst = tmp;
+	for (int pass = 0; pass < RADIX_PASSES; pass++) {
+		int shift = KEY_SEQ_BITS + pass * 8;
+		int* bucket = counts[pass];
+		if (bucket[(src[0] >> shift) & 0xFF] == count) continue;
+
+		int offset = 0;
+		for (int b = 0; b < 256; b++) {
+			int c = bucket[b];
+			bucket[b] = offset;
+			offset += c;
+		}
+		for (int i = 0; i < count; i++) {
+			dst[bucket[(src[i] >> shift) & 0xFF]++] = src[i];
+		}
+		std::swap(src, dst);
+	}
+	if (src != keys) {
+		memcpy(keys, src, sizeof(uint64_t) * count);
+	}
 }
 
 void draw_text(Vector2 dest, const char* text, float text_size, Color tint = WHITE) {
@@ -258,8 +885,7 @@ void draw_text(Vector2 dest, const char* text, float text_size, Color tint = WHI
 		.type = DRAW_OBJ_TEXT,
 		.dest = v4(dest.x, dest.y, 0, 0),
 		.tint = tint,
-		.text = text,
-		.text_size = text_size,
+		.run = text_run(text, (int)text_size),
 	});
 }
 
@@ -284,7 +910,7 @@ void draw_texture_v2(Vector4 src, Vector2 pos, Color tint = WHITE) {
 	renderer_add({
 		.type = DRAW_OBJ_TEXTURE,
 		.src = src,
-		.dest = {pos.x, pos.y, 0, 0},
+		.dest = {pos.x, pos.y, fabsf(src.z), fabsf(src.w)},
 		.tint = tint,
 	});
 }
@@ -299,213 +925,1106 @@ void draw_texture_pro(Texture2D texture, Vector4 src, Vector4 dest, Color tint =
 	});	
 }
 
+void batch_submit(SpriteBatch* batch) {
+	if (batch->count == 0) return;
+
+	rlSetTexture(batch->tex.id);
+	rlBegin(RL_QUADS);
+	rlNormal3f(0.0f, 0.0f, 1.0f);
+	for (int i = 0; i < batch->count; i++) {
+		SpriteVertex v = batch->items[i];
+		rlColor4ub(v.color.r, v.color.g, v.color.b, v.color.a);
+		rlTexCoord2f(v.u, v.v);
+		rlVertex2f(v.x, v.y);
+	}
+	rlEnd();
+	rlSetTexture(0);
+
+	stats_submit(batch->tex.id);
+	batch->count = 0;
+}
+
+// Sorts the queue by key and draws it. Runs of atlas sprites and runs of text
+// glyphs are batched; switching between the two, or drawing anything else,
+// submits what is pending first so sorted order is kept.
 void flush_renderer() {
-	for(int i = 0; i < MAX_LAYERS; i++) {
-		RenderLayer* layer = &renderer->layers[i];
-		for (int j = 0; j < layer->objs.count; j++) {
-			DrawObj it = layer->objs.items[j];
-			switch (it.type) {
-				case NONE:
-					break;
-				case DRAW_OBJ_QUAD:
-					DrawRectangleRec(to_rect(it.dest), it.tint);
-					break;
-				case DRAW_OBJ_TEXTURE:
-					DrawTextureRec(renderer->atlas, to_rect(it.src), {it.dest.x, it.dest.y}, it.tint);
-					break;
-				case DRAW_QUAD_LINES:
-					DrawRectangleLinesEx(to_rect(it.dest), it.line_tick, it.tint);
-					break;
-				case DRAW_OBJ_TEXTURE_PRO:
-					DrawTexturePro(it.tex, to_rect(it.src), to_rect(it.dest), ZERO, 0, it.tint);
-					break;
-				case DRAW_OBJ_TEXT:
-					DrawText(it.text, (int)it.dest.x, (int)it.dest.y, (int)it.text_size, it.tint);
-					break;
-			}	
+	PROFILE_ZONE("flush_renderer");
+	// Each flush goes to its own render target, whose switch ends rlgl's
+	// current draw.
+	renderer->stats.last_texture = 0;
+	int count = renderer->queue.count;
+	if (count > renderer->keys_capacity) {
+		renderer->keys_capacity = std::max(count, renderer->keys_capacity * 2);
+		renderer->keys = (uint64_t*)arena_alloc(&arena, sizeof(uint64_t) * renderer->keys_capacity);
+		renderer->keys_tmp = (uint64_t*)arena_alloc(&arena, sizeof(uint64_t) * renderer->keys_capacity);
+	}
+	for (int i = 0; i < count; i++) {
+		renderer->keys[i] = renderer->queue.items[i].key;
+	}
+	if (count > 0) {
+		radix_sort_keys(renderer->keys, renderer->keys_tmp, count);
+	}
+
+	renderer->text_batch.tex = GetFontDefault().texture;
+	for (int j = 0; j < count; j++) {
+		DrawObj it = renderer->queue.items[renderer->keys[j] & KEY_SEQ_MASK];
+		if (it.type == DRAW_OBJ_TEXTURE) {
+			batch_submit(&renderer->text_batch);
+			batch_push_quad(&renderer->batch, it.src, it.dest, it.tint);
+			renderer->stats.sprites += 1;
+			continue;
 		}
-		layer->objs.count = 0;
+		if (it.type == DRAW_OBJ_TEXT) {
+			batch_submit(&renderer->batch);
+			// DrawText truncates the position to ints.
+			float x = float(int(it.dest.x));
+			float y = float(int(it.dest.y));
+			for (int g = 0; g < it.run->glyph_count; g++) {
+				TextGlyph glyph = it.run->glyphs[g];
+				Vector4 dest = v4(x + glyph.dest.x, y + glyph.dest.y, glyph.dest.z, glyph.dest.w);
+				batch_push_quad(&renderer->text_batch, glyph.src, dest, it.tint);
+			}
+			renderer->stats.sprites += it.run->glyph_count;
+			continue;
+		}
+		batch_submit(&renderer->batch);
+		batch_submit(&renderer->text_batch);
+		// Shapes draw with rlgl's default white texture.
+		stats_submit(it.type == DRAW_OBJ_TEXTURE_PRO ? it.tex.id : rlGetTextureIdDefault());
+		switch (it.type) {
+			case NONE:
+				break;
+			case DRAW_OBJ_QUAD:
+				DrawRectangleRec(to_rect(it.dest), it.tint);
+				break;
+			case DRAW_OBJ_TEXTURE:
+				break;
+			case DRAW_QUAD_LINES:
+				DrawRectangleLinesEx(to_rect(it.dest), it.line_tick, it.tint);
+				break;
+			case DRAW_OBJ_TEXTURE_PRO:
+				DrawTexturePro(it.tex, to_rect(it.src), to_rect(it.dest), ZERO, 0, it.tint);
+				break;
+			case DRAW_OBJ_TEXT:
+				break;
+		}	
 	}
+	batch_submit(&renderer->batch);
+	batch_submit(&renderer->text_batch);
+	renderer->queue.count = 0;
 	assert(renderer->layer_stack.count == 0 && "unclosed layers!");
 }
 // ;renderer
 
-// :entity
-
-enum EntityId {
-	EID_NONE,
-	EID_BIRD,
-};
-
-enum EntityType {
-	ET_NONE,
-	ET_DEFENSE,
-	ET_FLOWER,
-	ET_THING,
-	ET_WORKER,
-	ET_PREDATOR,
-	ET_FIREBALL,
-	// :type
-};
-
-enum EntityProp {
-	EP_NONE,
-	EP_ATTACKABLE,
+// :audio
+// Set when running without a window/audio device (see run_headless).
+bool headless = false;
+
+// Sounds aren't played on the spot: play_sound queues a trigger and
+// sound_flush, once per frame, plays each queued sound once no matter how
+// many times it was triggered. Every sound gets SOUND_VOICES voices (itself
+// plus aliases sharing its samples), so a few copies can overlap; when all
+// are busy the one started longest ago restarts.
+#define SOUND_VOICES 4
+#define MAX_SOUNDS 16
+
+struct SoundVoices {
+	Sound voices[SOUND_VOICES];
+	// Voice to try first, the one started longest ago.
+	int next;
+	int pending;
 };
 
-struct ListEntityProp {
-	EntityProp *items;
+struct SoundQueue {
+	SoundVoices sounds[MAX_SOUNDS];
 	int count;
-	int capacity;
 };
 
-struct Entity {
-	int handle;
-	Vector2 pos, vel, size, remainder;
-	EntityId id;
-	EntityType type;
-	ListEntityProp props;
-	bool valid;
-	bool grounded;
-	Entity* last_collided;
-	rawptr user_data;
-	float facing;
-	Entity* riding;
-	bool trigger;
-	bool was_selected;
-	int health;
-	bool attacked;
-};
+SoundQueue sound_queue = {};
 
-void en_add_props(Entity* entity, std::initializer_list<EntityProp> props) {
-	for(EntityProp prop : props) {
-		arena_da_append(&arena, &entity->props, prop);
+void play_sound(Sound sound) {
+	if (headless || !sound.stream.buffer) return;
+	for (int i = 0; i < sound_queue.count; i++) {
+		if (sound_queue.sounds[i].voices[0].stream.buffer == sound.stream.buffer) {
+			sound_queue.sounds[i].pending += 1;
+			return;
+		}
+	}
+	assert(sound_queue.count < MAX_SOUNDS && "raise MAX_SOUNDS");
+	SoundVoices* entry = &sound_queue.sounds[sound_queue.count++];
+	entry->voices[0] = sound;
+	for (int v = 1; v < SOUND_VOICES; v++) {
+		entry->voices[v] = LoadSoundAlias(sound);
 	}
+	entry->next = 0;
+	entry->pending = 1;
 }
 
-bool en_has_prop(Entity en, EntityProp prop) {
-	for (int i = 0; i < en.props.count; i++) {
-		if (en.props.items[i] == prop) {
-			return true;
+void sound_flush() {
+	for (int i = 0; i < sound_queue.count; i++) {
+		SoundVoices* entry = &sound_queue.sounds[i];
+		if (entry->pending == 0) continue;
+		entry->pending = 0;
+		int voice = entry->next;
+		for (int k = 0; k < SOUND_VOICES; k++) {
+			int v = (entry->next + k) % SOUND_VOICES;
+			if (!IsSoundPlaying(entry->voices[v])) {
+				voice = v;
+				break;
+			}
 		}
+		PlaySound(entry->voices[voice]);
+		entry->next = (voice + 1) % SOUND_VOICES;
 	}
-	return false;
 }
+// ;audio
+
+// :sparse_set
+// Set of small non-negative ints (entity slots) with O(1) add, remove and
+// membership. Members are kept packed in dense[0..count) for iteration;
+// removal swaps the last member into the hole, so order is not stable.
+struct SparseSet {
+	int* dense;
+	int* sparse;
+	int count;
+};
 
-void en_setup(Entity* en, Vector2 pos, Vector2 size) {
-	en->pos = pos;
-	en->remainder = ZERO;
-	en->vel = ZERO;
-	en->size = size;
-	en->valid = true;
-	en->props = {};
+void sparse_set_init(SparseSet* set, int cap) {
+	set->dense = (int*)arena_alloc(&arena, sizeof(int) * cap);
+	set->sparse = (int*)arena_alloc(&arena, sizeof(int) * cap);
+	set->count = 0;
 }
 
-Rectangle en_box(Entity en) {
-	return rv2(en.pos, en.size);
+// Makes room for members up to new_cap; dense and sparse move.
+void sparse_set_grow(SparseSet* set, int cap, int new_cap) {
+	set->dense = (int*)arena_realloc(&arena, set->dense, sizeof(int) * cap, sizeof(int) * new_cap);
+	set->sparse = (int*)arena_realloc(&arena, set->sparse, sizeof(int) * cap, sizeof(int) * new_cap);
 }
 
-Vector2 en_center(Entity en) {
-	return {en.pos.x + en.size.x / 2, en.pos.y + en.size.y / 2};
+bool sparse_set_has(SparseSet* set, int i) {
+	int at = set->sparse[i];
+	return at >= 0 && at < set->count && set->dense[at] == i;
 }
 
-void en_invalidate(Entity* en) {
-	memset(en, 0, sizeof(Entity));	
+void sparse_set_add(SparseSet* set, int i) {
+	if (sparse_set_has(set, i)) return;
+	set->sparse[i] = set->count;
+	set->dense[set->count++] = i;
 }
 
-// ;entity
-
-// :data
-#define MAP_SIZE 100
-#define MAX_ENTITIES 2046 
-#define MAX_LIGHTS 1
-#define PLAYER_LIGHT_RADIUS 20
-#define TIME_FOR_PREDATOR 180
-
-enum Task {
-	TASK_NONE,
-	TASK_COLLECT,
-	TASK_REPRODUCE,
-	TASK_DEFENSE,
-};
+void sparse_set_remove(SparseSet* set, int i) {
+	if (!sparse_set_has(set, i)) return;
+	int at = set->sparse[i];
+	int last = set->dense[--set->count];
+	set->dense[at] = last;
+	set->sparse[last] = at;
+}
+// ;sparse_set
 
-// :thing
-struct ThingData {
-	Task current_task;
-	float perform_task_time;
-	int food_amt;
-	int worker_amt;
-	int last_worker_amt;
-};
+// :pool
+// Fixed-size object pool. Freed items go on an intrusive free list and are
+// handed out again before the pool grows by another block from the arena, so
+// memory stays flat once a session reaches its peak.
+#define POOL_BLOCK_ITEMS 256
 
-struct State {
-	Entity entities[MAX_ENTITIES];
-	Entity* player;
-	Entity *predator;
-	ThingData* thing_data;
-	Vector2 virtual_mouse;
-	Camera2D cam;
-	bool show_thing_ui;
-	float dt;
-	float dt_speed;
-	bool show_begin_message;
-	float time_for_predator;
-	int flower_cnt;
-	Sound remove_flower;
-	Sound shoot;
-	Sound died;
-	bool lost;
-	bool win;
+struct PoolFree {
+	PoolFree* next;
 };
-State *state = NULL;
 
-struct ListEntity {
-	Entity* items;
-	int count;
+struct Pool {
+	int item_size;
+	PoolFree* free;
+	int used;
 	int capacity;
+	int peak;
 };
-struct FrameData {
-	ListEntity flowers;
-};
-FrameData fdata = {};
 
-Entity* new_en() {
-	for(int i = 0; i < MAX_ENTITIES; i++) {
-		if (!state->entities[i].valid) {
-			state->entities[i].handle = i;
-			return &state->entities[i];
+void* pool_alloc(Pool* pool) {
+	if (!pool->free) {
+		char* block = (char*)arena_alloc(&arena, size_t(pool->item_size) * POOL_BLOCK_ITEMS);
+		for (int i = POOL_BLOCK_ITEMS - 1; i >= 0; i--) {
+			PoolFree* item = (PoolFree*)(block + size_t(i) * pool->item_size);
+			item->next = pool->free;
+			pool->free = item;
 		}
+		pool->capacity += POOL_BLOCK_ITEMS;
 	}
-	assert(true && "Ran out of entities");
-	return nullptr;
+	PoolFree* item = pool->free;
+	pool->free = item->next;
+	pool->used += 1;
+	pool->peak = std::max(pool->peak, pool->used);
+	memset(item, 0, pool->item_size);
+	return item;
+}
+
+void pool_free(Pool* pool, void* ptr) {
+	PoolFree* item = (PoolFree*)ptr;
+	item->next = pool->free;
+	pool->free = item;
+	pool->used -= 1;
 }
+// ;pool
+
+// :rng
+// PCG32 (pcg-random.org): 64 bits of state and an odd increment that picks
+// the stream, so generators seeded alike on different streams never
+// overlap. Everything the sim rolls comes from one of these, seeded from
+// session_seed, and stays the same across platforms and thread counts.
+struct Rng {
+	uint64_t state;
+	uint64_t inc;
+};
 
-ListEntity get_all_with_prop(EntityProp prop, Arena* allocator = &arena) {
-	ListEntity list = {};
+uint32_t rng_next(Rng* rng) {
+	uint64_t old = rng->state;
+	rng->state = old * 6364136223846793005ull + rng->inc;
+	uint32_t xorshifted = uint32_t(((old >> 18) ^ old) >> 27);
+	uint32_t rot = uint32_t(old >> 59);
+	return (xorshifted >> rot) | (xorshifted << ((-rot) & 31));
+}
 
-	for(Entity entity: state->entities) {
-		if(!entity.valid) { continue;}
-		if(en_has_prop(entity, prop)) {
-			arena_da_append(allocator, &list, entity);
-		}
-	}
+Rng rng_make(uint64_t seed, uint64_t stream) {
+	Rng rng = {0, (stream << 1) | 1};
+	rng_next(&rng);
+	rng.state += seed;
+	rng_next(&rng);
+	return rng;
+}
+
+// Inclusive on both ends, like GetRandomValue. Multiply-shift instead of
+// modulo; the bias is below span / 2^32.
+int rng_range(Rng* rng, int min, int max) {
+	if (min > max) std::swap(min, max);
+	uint64_t span = uint64_t(int64_t(max) - min) + 1;
+	return int(min + int64_t((rng_next(rng) * span) >> 32));
+}
 
-	return list;
+// Integer points inside area (x, y, w, h), edges included.
+Vector2 rng_point(Rng* rng, Vector4 area) {
+	float x = rng_range(rng, area.x, area.x + area.z);
+	float y = rng_range(rng, area.y, area.y + area.w);
+	return {x, y};
 }
 
-ListEntity get_all_with_type(EntityType type) {
-	ListEntity list = {};
+void rng_fill_points(Rng* rng, Vector2* out, int count, Vector4 area) {
+	for (int i = 0; i < count; i++) {
+		out[i] = rng_point(rng, area);
+	}
+}
+
+// One stream per subsystem, so adding a roll to one doesn't shift another.
+enum RngStream {
+	RNG_SPAWN,
+	RNG_WORKER,
+	RNG_PREDATOR,
+	RNG_DEFENSE,
+	// Seeds the per-job streams of each parallel update.
+	RNG_JOBS,
+	RNG_COUNT,
+};
+// ;rng
+
+// :jobs
+// Fork-join thread pool. parallel_for runs fn(job, user) for every job index
+// on the pool threads and the calling thread, and returns once all of them
+// finished. Jobs must not touch the arenas, raylib or anything another job
+// writes; see :commands for how entity updates defer their side effects.
+#define MAX_JOB_THREADS 15
+
+typedef void (*JobFn)(int job, void* user);
+
+struct JobSystem {
+	std::thread threads[MAX_JOB_THREADS];
+	int thread_count;
+	std::mutex mutex;
+	std::condition_variable wake;
+	std::condition_variable done;
+	// Current batch; only written by parallel_for while no thread is active.
+	JobFn fn;
+	void* user;
+	int job_count;
+	std::atomic<int> next_job;
+	std::atomic<int> remaining;
+	unsigned batch;
+	// Threads may only join a batch while it is open.
+	bool open;
+	int active;
+	bool quit;
+};
+
+JobSystem jobs;
 
-	for(Entity entity: state->entities) {
-		if(!entity.valid) { continue;}
-		if( entity.type == type) {
-			arena_da_append(&temp_arena, &list, entity);
+void jobs_run_batch() {
+	for (;;) {
+		int job = jobs.next_job.fetch_add(1);
+		if (job >= jobs.job_count) return;
+		jobs.fn(job, jobs.user);
+		if (jobs.remaining.fetch_sub(1) == 1) {
+			std::lock_guard<std::mutex> lock(jobs.mutex);
+			jobs.done.notify_all();
 		}
 	}
+}
 
-	return list;
+void jobs_thread() {
+	unsigned seen = 0;
+	std::unique_lock<std::mutex> lock(jobs.mutex);
+	for (;;) {
+		jobs.wake.wait(lock, [&] { return jobs.quit || (jobs.open && jobs.batch != seen); });
+		if (jobs.quit) return;
+		seen = jobs.batch;
+		jobs.active += 1;
+		lock.unlock();
+		jobs_run_batch();
+		lock.lock();
+		jobs.active -= 1;
+		if (jobs.active == 0) jobs.done.notify_all();
+	}
 }
 
+void jobs_shutdown() {
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+		jobs.quit = true;
+	}
+	jobs.wake.notify_all();
+	for (int i = 0; i < jobs.thread_count; i++) {
+		jobs.threads[i].join();
+	}
+	jobs.thread_count = 0;
+}
+
+// Starts one thread per extra hardware thread. The web build stays serial.
+void jobs_init() {
+#if !defined(PLATFORM_WEB)
+	int count = int(std::thread::hardware_concurrency()) - 1;
+	jobs.thread_count = std::clamp(count, 0, MAX_JOB_THREADS);
+	for (int i = 0; i < jobs.thread_count; i++) {
+		jobs.threads[i] = std::thread(jobs_thread);
+	}
+	atexit(jobs_shutdown);
+#endif
+}
+
+void parallel_for(int job_count, JobFn fn, void* user) {
+	if (jobs.thread_count == 0 || job_count <= 1) {
+		for (int job = 0; job < job_count; job++) fn(job, user);
+		return;
+	}
+
+	{
+		std::lock_guard<std::mutex> lock(jobs.mutex);
+		jobs.fn = fn;
+		jobs.user = user;
+		jobs.job_count = job_count;
+		jobs.remaining = job_count;
+		jobs.next_job = 0;
+		jobs.batch += 1;
+		jobs.open = true;
+	}
+	jobs.wake.notify_all();
+	jobs_run_batch();
+
+	std::unique_lock<std::mutex> lock(jobs.mutex);
+	jobs.done.wait(lock, [] { return jobs.remaining == 0; });
+	jobs.open = false;
+	jobs.done.wait(lock, [] { return jobs.active == 0; });
+}
+// ;jobs
+
+// :entity
+
+enum EntityId {
+	EID_NONE,
+	EID_BIRD,
+};
+
+enum EntityType {
+	ET_NONE,
+	ET_DEFENSE,
+	ET_FLOWER,
+	ET_THING,
+	ET_WORKER,
+	ET_PREDATOR,
+	ET_FIREBALL,
+	// :type
+	ET_COUNT,
+};
+
+// Mask of EntityTypes for grid queries.
+#define ET_BIT(type) (1u << (type))
+
+const char* entity_type_names[ET_COUNT] = {
+	"none", "defense", "flower", "thing", "worker", "predator", "fireball",
+};
+
+enum EntityProp {
+	EP_NONE,
+	EP_ATTACKABLE,
+	EP_COUNT,
+};
+
+// One bit per EntityProp.
+typedef uint32_t EntityProps;
+
+// Entity slot (see en_at) plus the generation the slot had when the handle
+// was taken. Generations start at 1, so a zeroed handle never resolves.
+struct EntityHandle {
+	int index;
+	unsigned generation;
+};
+
+// Cold per-entity record. pos, size, type and the alive bit live in the dense
+// arrays on State (see en_pos and friends).
+struct Entity {
+	int handle;
+	unsigned generation;
+	EntityProps props;
+	int health;
+	rawptr user_data;
+	bool was_selected;
+	bool attacked;
+};
+
+bool en_has_prop(Entity* en, EntityProp prop) {
+	return en->props & (1u << prop);
+}
+
+// ;entity
+
+// :data
+#define MAP_SIZE 100
+#define MAX_LIGHTS 1
+#define PLAYER_LIGHT_RADIUS 20
+#define TIME_FOR_PREDATOR 180
+
+// Entity slots come in chunks of ENTITY_CHUNK, at most MAX_ENTITY_CHUNKS of
+// them. ENTITY_BUDGET is the default soft limit on live entities.
+#define ENTITY_CHUNK_SHIFT 10
+#define ENTITY_CHUNK (1 << ENTITY_CHUNK_SHIFT)
+#define MAX_ENTITY_CHUNKS 1024
+#define ENTITY_BUDGET 2048
+
+// What new_en does once the budget is used up.
+enum OverflowPolicy {
+	// Fail the spawn; constructors return nullptr.
+	OVERFLOW_REFUSE,
+	// Free the oldest fireball and hand out its slot, refuse if there is none.
+	OVERFLOW_EVICT_FIREBALL,
+	// Go past the budget, adding chunks until MAX_ENTITY_CHUNKS.
+	OVERFLOW_GROW,
+};
+
+// :grid
+// Entities are bucketed by the cell their box center falls in. Cells are
+// hashed into a fixed bucket table, so the world is unbounded; queries widen
+// by the largest entity seen so a box reaching into a neighbouring cell is
+// still found.
+#define GRID_CELL 32
+#define GRID_BUCKETS 4096
+
+struct SpatialGrid {
+	// First slot per bucket, -1 when empty.
+	int* heads;
+	// Per slot: intrusive bucket list links and packed cell coordinates.
+	int* next;
+	int* prev;
+	int* bucket;
+	uint64_t* cell;
+	float max_extent;
+};
+
+// :timestep
+// The simulation always advances in SIM_DT steps; dt_speed changes how many
+// steps run per rendered frame, never the size of a step.
+#define SIM_DT (1.f / 60.f)
+#define MAX_DT_SPEED 64
+#define MAX_SIM_TICKS_PER_FRAME 256
+
+enum Task {
+	TASK_NONE,
+	TASK_COLLECT,
+	TASK_REPRODUCE,
+	TASK_DEFENSE,
+};
+
+// :fireball
+struct FireballData {
+	EntityHandle target;
+	// state->fireball_serial at spawn.
+	unsigned serial;
+};
+
+// :thing
+struct ThingData {
+	Task current_task;
+	float perform_task_time;
+	int food_amt;
+	int worker_amt;
+	int last_worker_amt;
+};
+
+struct State {
+	// :storage
+	// Hot data every update/render pass reads is kept in dense per-slot
+	// arrays; the rest of an entity sits in its cold Entity record. Entity
+	// records live in ENTITY_CHUNK-slot chunks that never move, so Entity
+	// pointers stay valid as storage grows. The per-slot arrays are indexed
+	// only and are reallocated, so don't keep pointers into them across a
+	// spawn.
+	int entity_cap;
+	// Live entities past which new_en applies entity_overflow.
+	int entity_budget;
+	OverflowPolicy entity_overflow;
+	Vector2* pos;
+	Vector2* size;
+	uint8_t* type;
+	uint64_t* alive;
+	Entity* entity_chunks[MAX_ENTITY_CHUNKS];
+	// Spawn counter, so eviction can find the oldest fireball.
+	unsigned fireball_serial;
+	// Slots carrying each EntityProp, kept in sync by en_add_props and
+	// en_invalidate.
+	SparseSet prop_index[EP_COUNT];
+	// Slots of each EntityType, so grid queries for rare types can skip the
+	// cell walk.
+	SparseSet type_index[ET_COUNT];
+	// Flowers no worker has picked yet. en_flower adds, a worker reserving
+	// one or en_invalidate removes.
+	SparseSet free_flowers;
+	// Backing store for user_data, one pool per EntityType.
+	Pool pools[ET_COUNT];
+	// Boxes of all live entities, kept in sync by en_setup, en_move_to and
+	// en_invalidate.
+	SpatialGrid grid;
+	Rng rng[RNG_COUNT];
+	// Stack of unused slots in entities; new_en pops, en_invalidate pushes.
+	int* free_slots;
+	int free_count;
+	int live_count;
+	int spawn_failures;
+	Entity* player;
+	EntityHandle predator;
+	ThingData* thing_data;
+	Vector2 virtual_mouse;
+	Camera2D cam;
+	bool show_thing_ui;
+	float dt;
+	float dt_speed;
+	bool show_begin_message;
+	float time_for_predator;
+	int flower_cnt;
+	Sound remove_flower;
+	Sound shoot;
+	Sound died;
+	bool lost;
+	bool win;
+};
+State *state = NULL;
+
+#define alive_words(cap) (((cap) + 63) / 64)
+
+// Grows the slot storage to hold at least cap entities. Per-slot arrays at
+// least double so repeated growth stays linear; new Entity records come in
+// whole chunks. New slots go on top of the free stack lowest first.
+void entities_reserve(int cap) {
+	int old_cap = state->entity_cap;
+	if (cap <= old_cap) return;
+	cap = std::max(cap, old_cap * 2);
+	cap = (cap + ENTITY_CHUNK - 1) & ~(ENTITY_CHUNK - 1);
+	cap = std::min(cap, MAX_ENTITY_CHUNKS * ENTITY_CHUNK);
+	if (cap <= old_cap) return;
+
+	#define grow_slots(ptr, T, old_n, new_n) ptr = (T*)arena_realloc(&arena, ptr, sizeof(T) * (old_n), sizeof(T) * (new_n))
+	grow_slots(state->pos, Vector2, old_cap, cap);
+	grow_slots(state->size, Vector2, old_cap, cap);
+	grow_slots(state->type, uint8_t, old_cap, cap);
+	grow_slots(state->alive, uint64_t, alive_words(old_cap), alive_words(cap));
+	grow_slots(state->free_slots, int, old_cap, cap);
+	memset(state->type + old_cap, 0, sizeof(uint8_t) * (cap - old_cap));
+	memset(state->alive + alive_words(old_cap), 0, sizeof(uint64_t) * (alive_words(cap) - alive_words(old_cap)));
+
+	for (int prop = 0; prop < EP_COUNT; prop++) {
+		sparse_set_grow(&state->prop_index[prop], old_cap, cap);
+	}
+	for (int type = 0; type < ET_COUNT; type++) {
+		sparse_set_grow(&state->type_index[type], old_cap, cap);
+	}
+	sparse_set_grow(&state->free_flowers, old_cap, cap);
+
+	SpatialGrid* grid = &state->grid;
+	grow_slots(grid->next, int, old_cap, cap);
+	grow_slots(grid->prev, int, old_cap, cap);
+	grow_slots(grid->bucket, int, old_cap, cap);
+	grow_slots(grid->cell, uint64_t, old_cap, cap);
+	memset(grid->bucket + old_cap, 0xFF, sizeof(int) * (cap - old_cap));
+	#undef grow_slots
+
+	for (int chunk = old_cap >> ENTITY_CHUNK_SHIFT; chunk < cap >> ENTITY_CHUNK_SHIFT; chunk++) {
+		Entity* entities = (Entity*)arena_alloc(&arena, sizeof(Entity) * ENTITY_CHUNK);
+		memset(entities, 0, sizeof(Entity) * ENTITY_CHUNK);
+		for (int k = 0; k < ENTITY_CHUNK; k++) {
+			entities[k].handle = (chunk << ENTITY_CHUNK_SHIFT) + k;
+		}
+		state->entity_chunks[chunk] = entities;
+	}
+
+	for (int i = cap - 1; i >= old_cap; i--) {
+		state->free_slots[state->free_count++] = i;
+	}
+	state->entity_cap = cap;
+}
+
+void entities_init(int budget, OverflowPolicy overflow) {
+	state->entity_budget = budget;
+	state->entity_overflow = overflow;
+	SpatialGrid* grid = &state->grid;
+	grid->heads = (int*)arena_alloc(&arena, sizeof(int) * GRID_BUCKETS);
+	memset(grid->heads, 0xFF, sizeof(int) * GRID_BUCKETS);
+	grid->max_extent = 0;
+	entities_reserve(budget);
+}
+
+// Allocates a zeroed State with room for budget entities.
+void alloc_state(int budget, OverflowPolicy overflow) {
+	state = (State*)arena_alloc(&arena, sizeof(State));
+	memset(state, 0, sizeof(State));
+	entities_init(budget, overflow);
+}
+
+Entity* en_at(int i) {
+	return &state->entity_chunks[i >> ENTITY_CHUNK_SHIFT][i & (ENTITY_CHUNK - 1)];
+}
+
+bool en_alive(int i) {
+	return (state->alive[i >> 6] >> (i & 63)) & 1;
+}
+
+// Range over live slots: for (int i : en_all()). Walks the alive bits a word
+// at a time; the current word is re-masked with the live bits on every step,
+// so slots invalidated mid-loop are skipped, while slots spawned mid-loop
+// are only seen if they land in a later word that existed when the loop
+// started. state->alive is re-read every step since a spawn may move it.
+struct AliveIter {
+	int words;
+	int word;
+	uint64_t bits;
+
+	int operator*() const { return (word << 6) + __builtin_ctzll(bits); }
+	bool operator!=(const AliveIter&) const { return word < words; }
+	void skip_empty() {
+		while (!bits && ++word < words) {
+			bits = state->alive[word];
+		}
+	}
+	void operator++() {
+		bits &= (bits - 1) & state->alive[word];
+		skip_empty();
+	}
+};
+
+struct AliveRange {
+	AliveIter begin() {
+		AliveIter it = {alive_words(state->entity_cap), 0, 0};
+		if (it.words > 0) it.bits = state->alive[0];
+		it.skip_empty();
+		return it;
+	}
+	AliveIter end() { return {}; }
+};
+
+AliveRange en_all() {
+	return {};
+}
+
+Vector2& en_pos(Entity* en) {
+	return state->pos[en->handle];
+}
+
+Vector2 en_size(Entity* en) {
+	return state->size[en->handle];
+}
+
+EntityType en_type(Entity* en) {
+	return (EntityType)state->type[en->handle];
+}
+
+Rectangle en_box(int i) {
+	return rv2(state->pos[i], state->size[i]);
+}
+
+Rectangle en_box(Entity* en) {
+	return en_box(en->handle);
+}
+
+Vector2 en_center(Entity* en) {
+	Vector2 pos = en_pos(en);
+	Vector2 size = en_size(en);
+	return {pos.x + size.x / 2, pos.y + size.y / 2};
+}
+
+uint64_t grid_cell(int cx, int cy) {
+	return uint64_t(uint32_t(cx)) << 32 | uint32_t(cy);
+}
+
+int grid_bucket(uint64_t cell) {
+	uint64_t h = cell * 0x9E3779B97F4A7C15ull;
+	return int(h >> 52) & (GRID_BUCKETS - 1);
+}
+
+int grid_coord(float v) {
+	return (int)floorf(v / GRID_CELL);
+}
+
+void grid_remove(int i) {
+	SpatialGrid* grid = &state->grid;
+	int b = grid->bucket[i];
+	if (b < 0) return;
+	int next = grid->next[i];
+	int prev = grid->prev[i];
+	if (prev >= 0) grid->next[prev] = next;
+	else grid->heads[b] = next;
+	if (next >= 0) grid->prev[next] = prev;
+	grid->bucket[i] = -1;
+}
+
+// Inserts slot i, or moves it if its center changed cells.
+void grid_update(int i) {
+	SpatialGrid* grid = &state->grid;
+	Vector2 size = state->size[i];
+	Vector2 center = state->pos[i] + size / 2;
+	uint64_t cell = grid_cell(grid_coord(center.x), grid_coord(center.y));
+	if (grid->bucket[i] >= 0 && grid->cell[i] == cell) return;
+
+	grid_remove(i);
+	int b = grid_bucket(cell);
+	grid->cell[i] = cell;
+	grid->bucket[i] = b;
+	grid->prev[i] = -1;
+	grid->next[i] = grid->heads[b];
+	if (grid->heads[b] >= 0) grid->prev[grid->heads[b]] = i;
+	grid->heads[b] = i;
+	grid->max_extent = fmaxf(grid->max_extent, fmaxf(size.x, size.y));
+}
+
+// Calls fn(slot) for every entity of a type in type_mask whose center cell
+// lies within area, widened by margin plus the largest entity extent. fn
+// returns false to stop early. Each slot is visited at most once; callers
+// do their own exact test. When the masked types have fewer members than
+// there are cells to walk (one predator vs. a wide range check), their
+// members are visited directly instead.
+template<typename F>
+void grid_each(Rectangle area, float margin, uint32_t type_mask, F&& fn) {
+	SpatialGrid* grid = &state->grid;
+	float pad = margin + grid->max_extent;
+	int cx0 = grid_coord(area.x - pad);
+	int cy0 = grid_coord(area.y - pad);
+	int cx1 = grid_coord(area.x + area.width + pad);
+	int cy1 = grid_coord(area.y + area.height + pad);
+
+	int members = 0;
+	for (int type = 0; type < ET_COUNT; type++) {
+		if (type_mask & ET_BIT(type)) members += state->type_index[type].count;
+	}
+	if (members <= (cx1 - cx0 + 1) * (cy1 - cy0 + 1)) {
+		for (int type = 0; type < ET_COUNT; type++) {
+			if (!(type_mask & ET_BIT(type))) continue;
+			SparseSet* index = &state->type_index[type];
+			for (int k = 0; k < index->count; k++) {
+				if (!fn(index->dense[k])) return;
+			}
+		}
+		return;
+	}
+
+	for (int cy = cy0; cy <= cy1; cy++) {
+		for (int cx = cx0; cx <= cx1; cx++) {
+			uint64_t cell = grid_cell(cx, cy);
+			// Buckets are shared between cells, so match the exact cell.
+			for (int i = grid->heads[grid_bucket(cell)]; i >= 0; i = grid->next[i]) {
+				if (grid->cell[i] != cell) continue;
+				if (!(type_mask & ET_BIT(state->type[i]))) continue;
+				if (!fn(i)) return;
+			}
+		}
+	}
+}
+
+// First entity of a type in type_mask whose box overlaps area, -1 if none.
+int grid_overlap(Rectangle area, uint32_t type_mask, int ignore = -1) {
+	int found = -1;
+	grid_each(area, 0, type_mask, [&](int i) {
+		if (i == ignore || !CheckCollisionRecs(area, en_box(i))) return true;
+		found = i;
+		return false;
+	});
+	return found;
+}
+
+// Entity of a type in type_mask whose pos is nearest to pos and closer than
+// radius, -1 if none.
+int grid_nearest(Vector2 pos, float radius, uint32_t type_mask) {
+	int found = -1;
+	float best = radius;
+	grid_each(rv2(pos, ZERO), radius, type_mask, [&](int i) {
+		float dist = Vector2Distance(pos, state->pos[i]);
+		if (dist < best) {
+			best = dist;
+			found = i;
+		}
+		return true;
+	});
+	return found;
+}
+
+void en_setup(Entity* en, Vector2 pos, Vector2 size, EntityType type) {
+	int i = en->handle;
+	state->pos[i] = pos;
+	state->size[i] = size;
+	state->type[i] = type;
+	state->alive[i >> 6] |= 1ull << (i & 63);
+	en->props = 0;
+	sparse_set_add(&state->type_index[type], i);
+	grid_update(i);
+}
+
+void en_move_to(Entity* en, Vector2 pos) {
+	state->pos[en->handle] = pos;
+	grid_update(en->handle);
+}
+
+// Allocates en->user_data from the pool of the entity's type; en_invalidate
+// hands it back. Must be called after en_setup.
+void* en_alloc_data_(Entity* en, int size) {
+	Pool* pool = &state->pools[en_type(en)];
+	if (pool->item_size == 0) {
+		// Rounded so the free-list link in every item stays aligned.
+		pool->item_size = (std::max(size, int(sizeof(PoolFree))) + 7) & ~7;
+	}
+	assert(size <= pool->item_size && "one payload type per entity type");
+	en->user_data = pool_alloc(pool);
+	return en->user_data;
+}
+#define en_alloc_data(en, T) ((T*)en_alloc_data_(en, sizeof(T)))
+
+void en_add_props(Entity* entity, std::initializer_list<EntityProp> props) {
+	for(EntityProp prop : props) {
+		entity->props |= 1u << prop;
+		sparse_set_add(&state->prop_index[prop], entity->handle);
+	}
+}
+
+void en_invalidate(Entity* en);
+
+// Applies entity_overflow once the budget is used up. Returns whether
+// new_en may hand out a slot.
+bool en_make_room() {
+	bool over_budget = state->live_count >= state->entity_budget;
+	switch (state->entity_overflow) {
+		case OVERFLOW_REFUSE:
+			return !over_budget && state->free_count > 0;
+		case OVERFLOW_EVICT_FIREBALL: {
+			if (!over_budget && state->free_count > 0) return true;
+			SparseSet* fireballs = &state->type_index[ET_FIREBALL];
+			Entity* oldest = nullptr;
+			unsigned oldest_age = 0;
+			for (int k = 0; k < fireballs->count; k++) {
+				Entity* en = en_at(fireballs->dense[k]);
+				unsigned age = state->fireball_serial - ((FireballData*)en->user_data)->serial;
+				if (!oldest || age > oldest_age) {
+					oldest = en;
+					oldest_age = age;
+				}
+			}
+			if (oldest) en_invalidate(oldest);
+			return oldest != nullptr;
+		}
+		case OVERFLOW_GROW:
+			if (state->free_count == 0) {
+				entities_reserve(state->entity_cap + 1);
+			}
+			return state->free_count > 0;
+	}
+	return false;
+}
+
+Entity* new_en() {
+	if (!en_make_room()) {
+		if (state->spawn_failures == 0) {
+			TraceLog(LOG_WARNING, "Ran out of entities (%d live)", state->live_count);
+		}
+		state->spawn_failures += 1;
+		return nullptr;
+	}
+	int i = state->free_slots[--state->free_count];
+	state->live_count += 1;
+	Entity* en = en_at(i);
+	en->generation += 1;
+	return en;
+}
+
+void en_invalidate(Entity* en) {
+	int handle = en->handle;
+	if (!en_alive(handle)) return;
+	state->alive[handle >> 6] &= ~(1ull << (handle & 63));
+	if (en->user_data) {
+		pool_free(&state->pools[state->type[handle]], en->user_data);
+	}
+	sparse_set_remove(&state->type_index[state->type[handle]], handle);
+	sparse_set_remove(&state->free_flowers, handle);
+	state->type[handle] = ET_NONE;
+	grid_remove(handle);
+	for (int prop = 0; prop < EP_COUNT; prop++) {
+		if (en->props & (1u << prop)) {
+			sparse_set_remove(&state->prop_index[prop], handle);
+		}
+	}
+	unsigned generation = en->generation;
+	memset(en, 0, sizeof(Entity));	
+	en->handle = handle;
+	en->generation = generation;
+	state->free_slots[state->free_count++] = handle;
+	state->live_count -= 1;
+}
+
+EntityHandle en_handle(Entity* en) {
+	if (!en) return {};
+	return {en->handle, en->generation};
+}
+
+// Returns nullptr once the entity the handle was taken from is gone, even if
+// its slot has been reused since.
+Entity* en_resolve(EntityHandle h) {
+	if (h.index < 0 || h.index >= state->entity_cap) return nullptr;
+	Entity* en = en_at(h.index);
+	if (!en_alive(h.index) || en->generation != h.generation) return nullptr;
+	return en;
+}
+
+// :query
+// Views over an index set yielding live Entity pointers: for (Entity* en :
+// query_prop(EP_ATTACKABLE)). Nothing is copied or allocated. The optional
+// filter skips entities it returns false for. Members must not be added to
+// or removed from the viewed set while iterating.
+typedef bool (*EntityFilter)(Entity* en);
+
+struct QueryIter {
+	const int* at;
+	const int* end;
+	EntityFilter filter;
+
+	Entity* operator*() const { return en_at(*at); }
+	bool operator!=(const QueryIter& other) const { return at != other.at; }
+	void skip_filtered() {
+		while (at != end && filter && !filter(en_at(*at))) at++;
+	}
+	void operator++() {
+		at++;
+		skip_filtered();
+	}
+};
+
+struct Query {
+	const int* first;
+	const int* last;
+	EntityFilter filter;
+
+	QueryIter begin() const {
+		QueryIter it = {first, last, filter};
+		it.skip_filtered();
+		return it;
+	}
+	QueryIter end() const { return {last, last, filter}; }
+
+	// O(1) unless filtered.
+	int count() const {
+		if (!filter) return int(last - first);
+		int n = 0;
+		for (const int* at = first; at != last; at++) n += filter(en_at(*at));
+		return n;
+	}
+
+	// k-th match, nullptr past the end. O(1) unless filtered.
+	Entity* nth(int k) const {
+		if (!filter) return k < int(last - first) ? en_at(first[k]) : nullptr;
+		for (Entity* en : *this) {
+			if (k-- == 0) return en;
+		}
+		return nullptr;
+	}
+};
+
+Query query_set(SparseSet* set, EntityFilter filter = nullptr) {
+	return {set->dense, set->dense + set->count, filter};
+}
+
+Query query_prop(EntityProp prop, EntityFilter filter = nullptr) {
+	return query_set(&state->prop_index[prop], filter);
+}
+
+Query query_type(EntityType type, EntityFilter filter = nullptr) {
+	return query_set(&state->type_index[type], filter);
+}
+
+// :commands
+// Side effects of entity updates that run inside parallel_for. Each job
+// records into its own buffer, and sim_tick applies the buffers in job order
+// afterwards, so the outcome does not depend on the thread count.
+enum CommandType {
+	CMD_MOVED,
+	CMD_INVALIDATE,
+	CMD_DAMAGE,
+	CMD_SOUND,
+	CMD_COLLECT_FLOWER,
+	CMD_SPAWN_FIREBALL,
+};
+
+struct Command {
+	CommandType type;
+	EntityHandle target;
+	int amount;
+	Vector2 pos;
+	Sound* sound;
+};
+
+struct CommandBuffer {
+	Command* items;
+	int count;
+	int capacity;
+	// Per buffer, so jobs never share an allocator.
+	Arena arena;
+};
+
+void cmd_push(CommandBuffer* cmds, Command cmd) {
+	arena_da_append(&cmds->arena, cmds, cmd);
+}
+
+// The entity's pos changed; its grid cell is updated on apply.
+void cmd_moved(CommandBuffer* cmds, Entity* en) {
+	cmd_push(cmds, {.type = CMD_MOVED, .target = en_handle(en)});
+}
+
+void cmd_invalidate(CommandBuffer* cmds, Entity* en) {
+	cmd_push(cmds, {.type = CMD_INVALIDATE, .target = en_handle(en)});
+}
+
+void cmd_damage(CommandBuffer* cmds, Entity* en, int amount) {
+	cmd_push(cmds, {.type = CMD_DAMAGE, .target = en_handle(en), .amount = amount});
+}
+
+void cmd_sound(CommandBuffer* cmds, Sound* sound) {
+	cmd_push(cmds, {.type = CMD_SOUND, .sound = sound});
+}
+
+void cmd_collect_flower(CommandBuffer* cmds, Entity* flower, int food) {
+	cmd_push(cmds, {.type = CMD_COLLECT_FLOWER, .target = en_handle(flower), .amount = food});
+}
+
+void cmd_spawn_fireball(CommandBuffer* cmds, Vector2 pos, EntityHandle target) {
+	cmd_push(cmds, {.type = CMD_SPAWN_FIREBALL, .target = target, .pos = pos});
+}
+// ;commands
+
 enum Layer {
 	L_NONE,
 	L_BACK,
@@ -517,30 +2036,67 @@ enum Layer {
 
 
 // :fireball
-Entity* en_fireball(Vector2 pos) {
+Entity* en_fireball(Vector2 pos, EntityHandle target) {
 	Entity* en = new_en();
+	if (!en) return nullptr;
 
-	en_setup(en, pos, v2of(16));
+	en_setup(en, pos, v2of(16), ET_FIREBALL);
 
-	en->type = ET_FIREBALL;
+	FireballData* data = en_alloc_data(en, FireballData);
+	data->target = target;
+	data->serial = state->fireball_serial++;
 
 	return en;
 }
 
+// Most entities one parallel job updates at once.
+#define SIM_JOB_ENTITIES 512
+
 //:fireball
-void en_fireball_update(Entity* self) {
-	if (state->predator == nullptr) return;
-	if (!CheckCollisionRecs(en_box(*self), en_box(*state->predator))) {
-		self->pos = Vector2MoveTowards(self->pos, state->predator->pos, 200 * state->dt);
-	} else {
-		state->predator->health -= 2;
-		en_invalidate(self);
+// Updates a run of fireball slots; the ones that didn't hit anything move
+// together through move_towards_batch.
+void en_fireball_update(const int* slots, int count, CommandBuffer* cmds) {
+	int moving[SIM_JOB_ENTITIES];
+	Vector2 pos[SIM_JOB_ENTITIES];
+	Vector2 target_pos[SIM_JOB_ENTITIES];
+	float max_dist[SIM_JOB_ENTITIES];
+	uint64_t arrived[SIM_JOB_ENTITIES / 64];
+	int n = 0;
+
+	for (int k = 0; k < count; k++) {
+		Entity* self = en_at(slots[k]);
+		FireballData* data = (FireballData*)self->user_data;
+		Entity* target = en_resolve(data->target);
+		if (!target) {
+			cmd_invalidate(cmds, self);
+			continue;
+		}
+		// Hits whichever predator it runs into first, not only its target.
+		int hit = grid_overlap(en_box(self), ET_BIT(ET_PREDATOR));
+		if (hit >= 0) {
+			cmd_damage(cmds, en_at(hit), 2);
+			cmd_invalidate(cmds, self);
+			continue;
+		}
+		moving[n] = slots[k];
+		pos[n] = en_pos(self);
+		target_pos[n] = en_pos(target);
+		max_dist[n] = 200 * state->dt;
+		n += 1;
 	}
-}
+	if (n == 0) return;
 
-void en_fireball_render(Entity self) {
+	move_towards_batch(pos, target_pos, max_dist, n, arrived);
+	for (int k = 0; k < n; k++) {
+		Entity* self = en_at(moving[k]);
+		en_pos(self) = pos[k];
+		cmd_moved(cmds, self);
+	}
+}
+
+void en_fireball_render(int i) {
 	push_layer(L_HUD);
-	draw_texture_v2(FIREBALL, self.pos);	
+	draw_texture_v2(FIREBALL, state->pos[i]);	
 	pop_layer();
 }
 
@@ -549,450 +2105,1705 @@ struct DefenseData {
 	float shoot_time;
 };
 
-// :defense
-Entity* en_defense(Vector2 pos, Vector2 size) {
-	Entity* en = new_en();
-	en_setup(en, pos, size);	
+// :defense
+Entity* en_defense(Vector2 pos, Vector2 size) {
+	Entity* en = new_en();
+	if (!en) return nullptr;
+	en_setup(en, pos, size, ET_DEFENSE);
+
+	DefenseData* data = en_alloc_data(en, DefenseData);
+	data->shoot_time = .12f;
+
+	en->health = 3;
+
+	en_add_props(en, {EP_ATTACKABLE});
+	return en;
+}
+
+void en_defense_update(Entity* self, CommandBuffer* cmds) {
+	DefenseData* data = (DefenseData*)self->user_data;
+	data->shoot_time -= state->dt;
+	int predator = grid_nearest(en_pos(self), RENDER_SIZE.x / 2, ET_BIT(ET_PREDATOR));
+	if (predator >= 0 && data->shoot_time < 0) {
+		cmd_spawn_fireball(cmds, en_pos(self), en_handle(en_at(predator)));
+		cmd_sound(cmds, &state->shoot);
+		data->shoot_time = 0.12;
+	}
+
+	if(self->health <= 0) {
+		cmd_sound(cmds, &state->died);
+		cmd_invalidate(cmds, self);
+	}
+}
+
+void en_defense_render(int i) {
+	push_layer(L_DEBUG_COL, y_depth(state->pos[i].y + state->size[i].y));
+	draw_texture_v2(DEFENSE_BUILDING, state->pos[i]);
+	pop_layer();
+}
+
+// :flower
+Entity* en_flower(Vector2 pos) {
+	Entity* en = new_en();
+	if (!en) return nullptr;
+
+	en_setup(en, pos, v2of(TILE_SIZE), ET_FLOWER);
+	sparse_set_add(&state->free_flowers, en->handle);
+
+	return en;
+}
+
+// :flower
+void en_flower_update(Entity* self) {
+	// noop
+}
+
+// :flower
+void en_flower_render(int i) {
+	Vector2 pos = state->pos[i];
+	push_layer(L_FLOWER);
+	draw_texture_v2(FLOWER_0, pos);
+	pop_layer();
+	push_layer(L_BACK);
+	draw_texture_v2(FLOWER_SPOT, {pos.x, pos.y + state->size[i].y / 2.f});
+	pop_layer();
+}
+
+struct PredatorData {
+	EntityHandle target;
+	float attack_time;
+};
+
+#define PREDATOR_HP 300 
+
+// :predator
+Entity* en_predator(Vector2 pos, Vector2 size) {
+	Entity* en = new_en();
+	if (!en) return nullptr;
+
+	en_setup(en, pos, size, ET_PREDATOR);
+
+	en->health = PREDATOR_HP;
+
+	PredatorData* data = en_alloc_data(en, PredatorData);
+	data->target = {};
+	data->attack_time = 1.f;
+	return en;
+}
+
+// :predator
+void en_predator_update(Entity* self) {
+	
+	PredatorData *data = (PredatorData*)self->user_data;
+	
+	Entity* target = en_resolve(data->target);
+	if (!target) {
+		// Defenses first, the colony once they are all gone.
+		Query defense = query_prop(EP_ATTACKABLE, [](Entity* en) { return en_type(en) != ET_THING; });
+		int count = defense.count();
+		if (count > 0) {
+			target = defense.nth(rng_range(&state->rng[RNG_PREDATOR], 0, count - 1));
+		} else {
+			target = query_prop(EP_ATTACKABLE).nth(0);
+		}
+		data->target = en_handle(target);
+	}
+
+	en_move_to(self, Vector2MoveTowards(en_pos(self), en_pos(target), 60 * state->dt));
+
+	data->attack_time -= state->dt;
+	if (CheckCollisionRecs(en_box(self), en_box(target)) && data->attack_time < 0) {
+		Entity *en = target;
+		en->health -= 1;
+		data->attack_time = 1;
+		en->attacked = true;
+	}
+
+	if (self->health <= 0) {
+		state->win = true;
+		en_invalidate(self);
+	}
+}
+
+// :predator
+void en_predator_render(int i) {
+	push_layer(L_DEBUG_COL, y_depth(state->pos[i].y + state->size[i].y));
+	draw_texture_v2(PREDATOR, state->pos[i]);
+	pop_layer();
+}
+
+struct WorkerData {
+	Task task;
+	EntityHandle target;
+};
+
+// :workers
+Entity* en_worker(Vector2 pos, Task task) {
+	Entity* en = new_en();
+	if (!en) return nullptr;
+
+	en_setup(en, pos, v2of(10), ET_WORKER);
+
+	WorkerData* data = en_alloc_data(en, WorkerData);
+	data->task = task;
+	data->target = {};
+
+	return en;
+}
+
+
+// :worker
+// Serial half of the worker update: reserving a flower touches shared state.
+void en_worker_pick_target(Entity* self) {
+	WorkerData* data = (WorkerData*)self->user_data;
+	SparseSet* free_flowers = &state->free_flowers;
+	if (!en_resolve(data->target) && free_flowers->count > 0) {
+		int flower = free_flowers->dense[rng_range(&state->rng[RNG_WORKER], 0, free_flowers->count - 1)];
+		sparse_set_remove(free_flowers, flower);
+		Entity* target = en_at(flower);
+		target->was_selected = true;
+		data->target = en_handle(target);
+	}
+}
+
+// :worker
+// Updates a run of worker slots: everyone with a flower steps towards it in
+// one move_towards_batch call, and the arrival mask says who collects.
+void en_worker_update(const int* slots, int count, Rng* rng, CommandBuffer* cmds) {
+	int moving[SIM_JOB_ENTITIES];
+	Entity* flowers[SIM_JOB_ENTITIES];
+	Vector2 pos[SIM_JOB_ENTITIES];
+	Vector2 target_pos[SIM_JOB_ENTITIES];
+	float max_dist[SIM_JOB_ENTITIES];
+	uint64_t arrived[SIM_JOB_ENTITIES / 64];
+	int n = 0;
+
+	for (int k = 0; k < count; k++) {
+		Entity* self = en_at(slots[k]);
+		WorkerData* data = (WorkerData*)self->user_data;
+		Entity* target = en_resolve(data->target);
+		if (!target) continue;
+		moving[n] = slots[k];
+		flowers[n] = target;
+		pos[n] = en_pos(self);
+		target_pos[n] = en_pos(target);
+		max_dist[n] = 100 * state->dt;
+		n += 1;
+	}
+	if (n == 0) return;
+
+	move_towards_batch(pos, target_pos, max_dist, n, arrived);
+	for (int k = 0; k < n; k++) {
+		Entity* self = en_at(moving[k]);
+		en_pos(self) = pos[k];
+		cmd_moved(cmds, self);
+
+		if ((arrived[k >> 6] >> (k & 63)) & 1) {
+			cmd_collect_flower(cmds, flowers[k], rng_range(rng, 2, 5));
+			cmd_invalidate(cmds, self);
+			cmd_sound(cmds, &state->remove_flower);
+		}
+	}
+}
+
+// :worker
+void en_worker_render(int i) {
+	push_layer(L_WORKER);
+	draw_texture_v2(WORKER_ICON, state->pos[i]);
+	pop_layer();
+}
+
+#define PERFORM_TASK_TIME .8f
+#define WORKER_AMT 20
+#define START_FOOD_AMT 100
+
+// :thing
+Entity* en_thing(Vector2 pos, Vector2 size) {
+	Entity* en = new_en();
+	if (!en) return nullptr;
+
+	en_setup(en, pos, size, ET_THING);
+
+	ThingData* data = en_alloc_data(en, ThingData);
+	memset(data, 0, sizeof(ThingData));
+	data->perform_task_time = PERFORM_TASK_TIME;
+	data->current_task = TASK_NONE;
+	data->worker_amt = WORKER_AMT;
+	data->food_amt = START_FOOD_AMT;
+
+	en->health = 100;
+
+	en_add_props(en, {EP_ATTACKABLE});
+
+	return en;
+}
+
+// :thing
+void en_thing_update(Entity* self) {
+
+	ThingData* data = (ThingData*)self->user_data;
+	
+	switch (data->current_task) {
+		case TASK_NONE:
+			break;
+		case TASK_COLLECT:
+			if(data->worker_amt > 0) {
+				data->perform_task_time -= state->dt;
+				if (data->perform_task_time < 0 && state->free_flowers.count > 0) {
+					en_worker(en_center(self), data->current_task);
+					data->perform_task_time = PERFORM_TASK_TIME;
+					data->worker_amt -= 1;
+					data->food_amt -= 1;
+				}
+			} else {
+				data->current_task = TASK_NONE;
+				data->worker_amt = data->last_worker_amt;
+			}
+			break;
+		case TASK_DEFENSE:
+		{
+			data->food_amt -= 200;
+			data->worker_amt -= 10;
+			Vector2 pos = rng_point(&state->rng[RNG_DEFENSE], SPAWN_AREA);
+			en_defense(pos, v2(DEFENSE_BUILDING.z, DEFENSE_BUILDING.w));
+
+			data->current_task = TASK_NONE;
+		}
+		break;
+		case TASK_REPRODUCE:
+		{
+			data->food_amt -= 2 * (data->worker_amt / 2);
+			data->worker_amt += data->worker_amt / 2;
+			data->current_task = TASK_NONE;
+		}
+		break;
+	}
+
+	if (self->health <= 0) {
+		state->lost = true;
+	}
+
+	if (self->attacked) {
+		if (query_prop(EP_ATTACKABLE).count() == 1) {
+			state->lost = true;
+		}
+	}
+}
+
+// :thing
+void en_thing_render(int i) {
+	Vector2 pos = state->pos[i];
+	Vector2 size = state->size[i];
+	push_layer(L_DEBUG_COL, y_depth(pos.y + size.y));
+	draw_texture_v2(THING, pos);
+	pop_layer();
+	draw_texture_v2(THING_SPOT, {(pos.x + (size.x - THING_SPOT.z) * .5f), (pos.y + size.y / 2)});
+}
+
+
+
+bool ui_btn(Vector2 pos, const char* text, float text_size, bool can_click = true) {
+
+	Vector4 dest = v4zw(96, 32);
+	dest.x = pos.x;
+	dest.y = pos.y;
+
+	bool hover = false;
+	bool clicked = false;
+
+	if (CheckCollisionPointRec(state->virtual_mouse, to_rect(dest))) {
+		hover = true;
+		if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
+			clicked = true;
+		}
+	}
+
+	float text_sz = measure_text(text, text_size);
+	Vector2 text_pos = { 
+		(dest.z - text_sz) * .5f, 
+		(dest.w - text_size) * .5f,
+	};
+
+	text_pos = xyv4(dest) + text_pos;
+
+	draw_texture_v2({128, hover ? 240.f : 208.f, 96, 32}, pos);
+	draw_text(text_pos, text, text_size);
+
+	if(!can_click) {
+		draw_quad(v4(pos.x, pos.y, 96, 32), ColorAlpha(GRAY, .8));
+	}
+
+	return clicked && can_click;
+}
+
+Music loop_1;
+Music predator_music;
+Sound ui_click;
+Sound hover_sound;
+Music music;
+float volume = 0;
+
+// Stops the current track and fades track in from silence.
+void switch_music(Music track) {
+	StopMusicStream(music);
+	music = track;
+	volume = 0.f;
+	PlayMusicStream(music);
+}
+// Time to first frame, printed once it is on screen.
+std::chrono::steady_clock::time_point startup_start;
+double startup_assets_ms = 0;
+bool startup_reported = false;
+float flower_spawn_time = 0.f;
+float sim_accumulator = 0.f;
+bool in_predator = false;
+Vector2 player_pos;
+RenderTexture2D game_texture;
+RenderTexture2D light_texture;
+RenderTexture2D ui_texture;
+
+// :sim_jobs
+// Defenses, workers and fireballs update in parallel, SIM_JOB_ENTITIES at a
+// time, over a snapshot of their type_index members. Everything they change
+// outside their own slot goes through the job's CommandBuffer.
+
+struct SimJob {
+	EntityType type;
+	const int* slots;
+	int count;
+	// Seeded from the job's index, so rolls don't depend on which thread
+	// runs it.
+	Rng rng;
+};
+
+struct SimJobs {
+	SimJob* items;
+	int count;
+	int capacity;
+	CommandBuffer* buffers;
+	int buffer_count;
+};
+
+SimJobs sim_jobs = {};
+
+void sim_job_run(int job, void* user) {
+	SimJobs* jobs = (SimJobs*)user;
+	SimJob* sim_job = &jobs->items[job];
+	CommandBuffer* cmds = &jobs->buffers[job];
+	switch (sim_job->type) {
+		case ET_DEFENSE:
+			for (int k = 0; k < sim_job->count; k++) {
+				en_defense_update(en_at(sim_job->slots[k]), cmds);
+			}
+			break;
+		case ET_WORKER:
+			en_worker_update(sim_job->slots, sim_job->count, &sim_job->rng, cmds);
+			break;
+		case ET_FIREBALL:
+			en_fireball_update(sim_job->slots, sim_job->count, cmds);
+			break;
+		default:
+			break;
+	}
+}
+
+void apply_commands(CommandBuffer* cmds) {
+	for (int i = 0; i < cmds->count; i++) {
+		Command cmd = cmds->items[i];
+		Entity* target = en_resolve(cmd.target);
+		switch (cmd.type) {
+			case CMD_MOVED:
+				if (target) grid_update(cmd.target.index);
+				break;
+			case CMD_INVALIDATE:
+				if (target) en_invalidate(target);
+				break;
+			case CMD_DAMAGE:
+				if (target) target->health -= cmd.amount;
+				break;
+			case CMD_SOUND:
+				play_sound(*cmd.sound);
+				break;
+			case CMD_COLLECT_FLOWER:
+				if (target) {
+					en_invalidate(target);
+					state->flower_cnt -= 1;
+					state->thing_data->food_amt += cmd.amount;
+				}
+				break;
+			case CMD_SPAWN_FIREBALL:
+				en_fireball(cmd.pos, cmd.target);
+				break;
+		}
+	}
+	cmds->count = 0;
+}
+
+void sim_parallel_update() {
+	sim_jobs.count = 0;
+	uint64_t seed = (uint64_t(rng_next(&state->rng[RNG_JOBS])) << 32) | rng_next(&state->rng[RNG_JOBS]);
+	EntityType types[] = {ET_DEFENSE, ET_WORKER, ET_FIREBALL};
+	for (EntityType type : types) {
+		SparseSet* set = &state->type_index[type];
+		for (int begin = 0; begin < set->count; begin += SIM_JOB_ENTITIES) {
+			SimJob job = {type, set->dense + begin, std::min(SIM_JOB_ENTITIES, set->count - begin), rng_make(seed, sim_jobs.count)};
+			arena_da_append(&arena, &sim_jobs, job);
+		}
+	}
+	if (sim_jobs.count > sim_jobs.buffer_count) {
+		CommandBuffer* buffers = (CommandBuffer*)arena_alloc(&arena, sizeof(CommandBuffer) * sim_jobs.capacity);
+		memset(buffers, 0, sizeof(CommandBuffer) * sim_jobs.capacity);
+		if (sim_jobs.buffer_count > 0) {
+			memcpy(buffers, sim_jobs.buffers, sizeof(CommandBuffer) * sim_jobs.buffer_count);
+		}
+		sim_jobs.buffers = buffers;
+		sim_jobs.buffer_count = sim_jobs.capacity;
+	}
+
+	{
+		PROFILE_ZONE_MERGED("parallel_update");
+		parallel_for(sim_jobs.count, sim_job_run, &sim_jobs);
+	}
+	{
+		PROFILE_ZONE_MERGED("apply_commands");
+		for (int job = 0; job < sim_jobs.count; job++) {
+			apply_commands(&sim_jobs.buffers[job]);
+		}
+	}
+}
+
+// :sim
+// One simulation step: everything update_frame does that doesn't need a window,
+// audio device or render target.
+void sim_tick() {
+	PROFILE_ZONE_MERGED("sim_tick");
+	state->dt = SIM_DT;
+
+	arena_reset(&temp_arena);
+
+	if (state->thing_data->current_task == TASK_NONE && !state->show_begin_message && !in_predator) {
+		state->show_thing_ui = true;
+		state->dt_speed = 1;
+	}
+
+	if (!state->show_thing_ui && !state->show_begin_message) {
+		state->time_for_predator -= state->dt;
+	}
+
+	if (state->time_for_predator <= 0) {
+		if (!in_predator) {
+			state->dt_speed = 1;
+			state->predator = en_handle(en_predator(v2(0, -RENDER_SIZE.y / 2), v2(PREDATOR.z, PREDATOR.w)));
+			in_predator =  true;
+		}
+	}
+
+	// :spawn
+	{
+		PROFILE_ZONE_MERGED("spawn");
+		flower_spawn_time -= state->dt;
+		if (flower_spawn_time < 0 && state->flower_cnt < 300) {
+			Vector2 pos = rng_point(&state->rng[RNG_SPAWN], SPAWN_AREA);
+
+			bool on_building = grid_overlap(rv2(pos, v2of(TILE_SIZE)), ET_BIT(ET_THING) | ET_BIT(ET_DEFENSE)) >= 0;
+			bool out_of_bounds = pos.x + 16 > RENDER_SIZE.x / 2 || pos.x < -RENDER_SIZE.x / 2 || pos.y + 16 > RENDER_SIZE.x / 2 || pos.y < -RENDER_SIZE.x / 2;
+			if(!on_building && !out_of_bounds) {
+				en_flower(pos);
+				state->flower_cnt += 1;
+			}
+
+
+			flower_spawn_time = 2.f;
+		}
+	}
+
+	// Serial phase: updates that change shared state directly. Timed as a
+	// whole; a zone per entity would cost more than most of the updates.
+	{
+		PROFILE_ZONE_MERGED("serial_update");
+		for (int i : en_all()) {
+			Entity* en	= en_at(i);
+			switch (state->type[i]) {
+				case ET_THING:
+					en_thing_update(en);
+					break;
+				case ET_PREDATOR:
+					en_predator_update(en);
+					break;
+				case ET_WORKER:
+					en_worker_pick_target(en);
+					break;
+				default:
+					break;
+			}
+		}
+	}
+
+	sim_parallel_update();
+}
+
+// :input
+// Everything the player does that changes the simulation is an Input. They
+// are queued while the frame runs and applied by sim_frame before its next
+// steps, which is also where a replay feeds recorded ones back in.
+enum InputType {
+	INPUT_START,
+	INPUT_SET_TASK,
+	INPUT_SKIP,
+	INPUT_SPEED_UP,
+	INPUT_SPEED_DOWN,
+};
+
+struct Input {
+	uint8_t type;
+	// Task for INPUT_SET_TASK.
+	uint8_t arg;
+};
+
+struct ListInput {
+	Input* items;
+	int count;
+	int capacity;
+};
+
+void apply_input(Input input) {
+	switch (input.type) {
+		case INPUT_START:
+			state->show_begin_message = false;
+			state->show_thing_ui = true;
+			break;
+		case INPUT_SET_TASK: {
+			ThingData* data = state->thing_data;
+			data->current_task = (Task)input.arg;
+			// Reproducing is instant, so the panel stays up for the next pick.
+			if (data->current_task != TASK_REPRODUCE) {
+				state->show_thing_ui = false;
+			}
+			data->last_worker_amt = data->worker_amt;
+		} break;
+		case INPUT_SKIP:
+			state->dt_speed = 10;
+			break;
+		case INPUT_SPEED_UP:
+			state->dt_speed += 1;
+			break;
+		case INPUT_SPEED_DOWN:
+			state->dt_speed -= 1;
+			break;
+	}
+}
+
+// :replay
+// A recording is the session seed, every frame's dt with the inputs applied
+// at its start, and a state checksum taken when recording stopped. Playing
+// it back through sim_frame must land on the same checksum.
+#define REPLAY_MAGIC 0x50524c44 // "LDRP"
+#define REPLAY_VERSION 3
+
+enum ReplayMode {
+	REPLAY_OFF,
+	REPLAY_RECORD,
+	REPLAY_PLAY,
+};
+
+struct ReplayFrame {
+	float dt;
+	uint32_t input_count;
+};
 
-	en->type = ET_DEFENSE;
+struct ListReplayFrame {
+	ReplayFrame* items;
+	int count;
+	int capacity;
+};
 
-	DefenseData *data = (DefenseData*)arena_alloc(&arena, sizeof(DefenseData));
-	data->shoot_time = .12f;
+struct ReplayHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint64_t seed;
+	uint64_t checksum;
+	uint32_t frame_count;
+	uint32_t input_count;
+	// Entity limits change what spawns, so playback has to match them.
+	int32_t entity_budget;
+	uint32_t entity_overflow;
+};
 
-	en->health = 3;
+struct Replay {
+	ReplayMode mode;
+	const char* path;
+	ListReplayFrame frames;
+	// Inputs of all frames, in order.
+	ListInput inputs;
+	// Queued this frame, applied by the next sim_frame.
+	ListInput pending;
+	// Playback cursors.
+	int frame;
+	int input;
+	uint64_t checksum;
+	// Entity limits the recording was made with.
+	int entity_budget;
+	OverflowPolicy entity_overflow;
+};
 
-	en->user_data = data;
+Replay replay = {};
+// Seeds everything random in a session.
+uint64_t session_seed = 1;
 
-	en_add_props(en, {EP_ATTACKABLE});
-	return en;
+void queue_input(Input input) {
+	if (replay.mode == REPLAY_PLAY) return;
+	arena_da_append(&arena, &replay.pending, input);
 }
 
-void en_defense_update(Entity* self) {
-	if (state->predator == nullptr) return;
+bool replay_finished() {
+	return replay.mode == REPLAY_PLAY && replay.frame == replay.frames.count;
+}
 
-	DefenseData* data = (DefenseData*)self->user_data;
-	data->shoot_time -= state->dt;
-	if (Vector2Distance(self->pos, state->predator->pos) < RENDER_SIZE.x / 2 && data->shoot_time < 0) {
-		en_fireball(self->pos);
-		PlaySound(state->shoot);
-		data->shoot_time = 0.12;
+uint64_t state_checksum() {
+	uint64_t hash = 14695981039346656037ull;
+	auto mix = [&](const void* data, size_t size) {
+		for (size_t i = 0; i < size; i++) {
+			hash = (hash ^ ((const uint8_t*)data)[i]) * 1099511628211ull;
+		}
+	};
+	for (int i : en_all()) {
+		mix(&i, sizeof(i));
+		mix(&state->pos[i], sizeof(Vector2));
+		mix(&state->type[i], sizeof(uint8_t));
+		mix(&en_at(i)->health, sizeof(int));
 	}
+	ThingData* data = state->thing_data;
+	mix(&data->food_amt, sizeof(int));
+	mix(&data->worker_amt, sizeof(int));
+	mix(&data->current_task, sizeof(Task));
+	mix(&state->flower_cnt, sizeof(int));
+	mix(&state->time_for_predator, sizeof(float));
+	mix(&state->lost, sizeof(bool));
+	mix(&state->win, sizeof(bool));
+	return hash;
+}
 
-	if(self->health <= 0) {
-		PlaySound(state->died);
-		en_invalidate(self);
+bool replay_save() {
+	ReplayHeader header = {
+		.magic = REPLAY_MAGIC,
+		.version = REPLAY_VERSION,
+		.seed = session_seed,
+		.checksum = state_checksum(),
+		.frame_count = uint32_t(replay.frames.count),
+		.input_count = uint32_t(replay.inputs.count),
+		.entity_budget = state->entity_budget,
+		.entity_overflow = uint32_t(state->entity_overflow),
+	};
+	size_t frames_size = sizeof(ReplayFrame) * replay.frames.count;
+	size_t inputs_size = sizeof(Input) * replay.inputs.count;
+	size_t size = sizeof(header) + frames_size + inputs_size;
+	uint8_t* data = (uint8_t*)arena_alloc(&temp_arena, size);
+	memcpy(data, &header, sizeof(header));
+	memcpy(data + sizeof(header), replay.frames.items, frames_size);
+	memcpy(data + sizeof(header) + frames_size, replay.inputs.items, inputs_size);
+	if (!SaveFileData(replay.path, data, int(size))) {
+		TraceLog(LOG_WARNING, "Failed to save replay %s", replay.path);
+		return false;
 	}
+	printf("replay: recorded %d frames to %s, checksum %016llx\n",
+			replay.frames.count, replay.path, (unsigned long long)header.checksum);
+	return true;
 }
 
-void en_defense_render(Entity self) {
-	push_layer(L_DEBUG_COL);
-	draw_texture_v2(DEFENSE_BUILDING, self.pos);
-	pop_layer();
-}
+bool replay_load(const char* path) {
+	int size = 0;
+	uint8_t* data = LoadFileData(path, &size);
+	ReplayHeader header = {};
+	if (data && size >= int(sizeof(header))) {
+		memcpy(&header, data, sizeof(header));
+	}
+	size_t expected = sizeof(header) + sizeof(ReplayFrame) * size_t(header.frame_count) + sizeof(Input) * size_t(header.input_count);
+	if (header.magic != REPLAY_MAGIC || header.version != REPLAY_VERSION || size_t(size) != expected
+			|| header.entity_budget < 1 || header.entity_overflow > OVERFLOW_GROW) {
+		fprintf(stderr, "replay: %s is not a version %d recording\n", path, REPLAY_VERSION);
+		if (data) UnloadFileData(data);
+		return false;
+	}
 
-// :flower
-Entity* en_flower(Vector2 pos) {
-	Entity* en = new_en();
+	replay = {};
+	replay.mode = REPLAY_PLAY;
+	replay.path = path;
+	replay.checksum = header.checksum;
+	replay.entity_budget = header.entity_budget;
+	replay.entity_overflow = OverflowPolicy(header.entity_overflow);
+	session_seed = header.seed;
+	uint8_t* at = data + sizeof(header);
+	for (uint32_t i = 0; i < header.frame_count; i++, at += sizeof(ReplayFrame)) {
+		ReplayFrame frame;
+		memcpy(&frame, at, sizeof(frame));
+		arena_da_append(&arena, &replay.frames, frame);
+	}
+	for (uint32_t i = 0; i < header.input_count; i++, at += sizeof(Input)) {
+		Input input;
+		memcpy(&input, at, sizeof(input));
+		arena_da_append(&arena, &replay.inputs, input);
+	}
+	UnloadFileData(data);
+	return true;
+}
 
-	en_setup(en, pos, v2of(TILE_SIZE));
-	en->type = ET_FLOWER;
+bool replay_verify() {
+	uint64_t checksum = state_checksum();
+	bool match = checksum == replay.checksum;
+	printf("replay: %d frames, checksum %016llx %s recorded %016llx\n",
+			replay.frames.count, (unsigned long long)checksum, match ? "matches" : "DIFFERS from",
+			(unsigned long long)replay.checksum);
+	return match;
+}
 
-	return en;
+// Applies the frame's inputs, then runs as many fixed steps as frame_dt
+// pays for. Returns the number of steps. While playing back, the recorded
+// dt and inputs are used instead.
+int sim_frame(float frame_dt) {
+	if (replay.mode == REPLAY_PLAY) {
+		if (replay_finished()) return 0;
+		ReplayFrame frame = replay.frames.items[replay.frame++];
+		frame_dt = frame.dt;
+		for (uint32_t i = 0; i < frame.input_count; i++) {
+			apply_input(replay.inputs.items[replay.input++]);
+		}
+	} else {
+		if (replay.mode == REPLAY_RECORD) {
+			arena_da_append(&arena, &replay.frames, (ReplayFrame{frame_dt, uint32_t(replay.pending.count)}));
+		}
+		for (int i = 0; i < replay.pending.count; i++) {
+			if (replay.mode == REPLAY_RECORD) {
+				arena_da_append(&arena, &replay.inputs, replay.pending.items[i]);
+			}
+			apply_input(replay.pending.items[i]);
+		}
+		replay.pending.count = 0;
+	}
+	state->dt_speed = Clamp(state->dt_speed, 1, MAX_DT_SPEED);
+
+	// :step
+	// Real frame time is banked and spent in fixed steps, each costing
+	// SIM_DT / dt_speed seconds, so a speed change made by a step applies
+	// to the very next one. A frame runs at most MAX_SIM_TICKS_PER_FRAME
+	// steps; whatever is still banked after that is dropped so a long
+	// hitch slows the game down instead of snowballing.
+	sim_accumulator += frame_dt;
+	int ticks = 0;
+	while (sim_accumulator >= SIM_DT / state->dt_speed) {
+		if (ticks == MAX_SIM_TICKS_PER_FRAME) {
+			sim_accumulator = 0;
+			break;
+		}
+		sim_accumulator -= SIM_DT / state->dt_speed;
+		sim_tick();
+		ticks += 1;
+	}
+	return ticks;
 }
 
-// :flower
-void en_flower_update(Entity* self) {
-	// noop
+// :snapshot
+// Binary save state. The file is the slot arrays, index sets and grid
+// copied as they are, so loading is a map and a handful of memcpys plus
+// one pass over live slots. Pointers are stored relocatable: user_data as
+// the file offset of the payload, player and predator as handles. Derived
+// order (free stack, index sets, grid lists) is kept, so a loaded session
+// continues exactly as the saved one would have.
+#define SNAPSHOT_MAGIC 0x4e53444c // "LDSN"
+#define SNAPSHOT_VERSION 1
+#define SNAPSHOT_PATH "snapshot.bin"
+// Index sets saved: one per prop, one per type and free_flowers.
+#define SNAPSHOT_SETS (int(EP_COUNT) + int(ET_COUNT) + 1)
+
+// Read-only view of a whole file, NULL if it can't be opened. The web build
+// has no mmap and reads it instead.
+void* map_file(const char* path, size_t* size) {
+#if defined(PLATFORM_WEB)
+	int data_size = 0;
+	unsigned char* data = LoadFileData(path, &data_size);
+	*size = size_t(data_size);
+	return data;
+#elif defined(_WIN32)
+	void* file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
+	if (file == INVALID_HANDLE_VALUE) return NULL;
+	unsigned long high = 0;
+	unsigned long low = GetFileSize(file, &high);
+	*size = (size_t(high) << 32) | low;
+	void* mapping = *size > 0 ? CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL) : NULL;
+	CloseHandle(file);
+	if (!mapping) return NULL;
+	void* data = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0);
+	CloseHandle(mapping);
+	return data;
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) return NULL;
+	struct stat st;
+	void* data = NULL;
+	if (fstat(fd, &st) == 0 && st.st_size > 0) {
+		*size = size_t(st.st_size);
+		data = mmap(NULL, *size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (data == MAP_FAILED) data = NULL;
+	}
+	close(fd);
+	return data;
+#endif
 }
 
-// :flower
-void en_flower_render(Entity self) {
-	push_layer(L_FLOWER);
-	draw_texture_v2(FLOWER_0, self.pos);
-	pop_layer();
-	push_layer(L_BACK);
-	draw_texture_v2(FLOWER_SPOT, {self.pos.x, self.pos.y + self.size.y / 2.f});
-	pop_layer();
+void unmap_file(void* data, size_t size) {
+#if defined(PLATFORM_WEB)
+	UnloadFileData((unsigned char*)data);
+#elif defined(_WIN32)
+	UnmapViewOfFile(data);
+#else
+	munmap(data, size);
+#endif
 }
 
-struct PredatorData {
-	int handle;
-	float attack_time;
+struct SnapshotHeader {
+	uint32_t magic;
+	uint32_t version;
+	// Rejects files written by a build with a different record layout.
+	uint32_t entity_size;
+	uint32_t payload_size[ET_COUNT];
+	uint64_t size;
+	int entity_cap;
+	int free_count;
+	int live_count;
+	int spawn_failures;
+	int set_count[SNAPSHOT_SETS];
+	EntityHandle player;
+	EntityHandle predator;
+	Rng rng[RNG_COUNT];
+	unsigned fireball_serial;
+	int flower_cnt;
+	float dt_speed;
+	float time_for_predator;
+	float flower_spawn_time;
+	float sim_accumulator;
+	float grid_max_extent;
+	bool in_predator;
+	bool show_thing_ui;
+	bool show_begin_message;
+	bool lost;
+	bool win;
 };
 
-#define PREDATOR_HP 300 
+// Sections are 8-byte aligned. With data == NULL only the size is counted.
+// size bounds reads.
+struct SnapshotCursor {
+	uint8_t* data;
+	size_t at;
+	size_t size;
+};
 
-// :predator
-Entity* en_predator(Vector2 pos, Vector2 size) {
-	Entity* en = new_en();
+size_t snapshot_put(SnapshotCursor* c, const void* src, size_t size) {
+	size_t at = c->at;
+	if (c->data && size > 0) memcpy(c->data + at, src, size);
+	c->at = (at + size + 7) & ~size_t(7);
+	return at;
+}
 
-	en_setup(en, pos, size);
-	en->type = ET_PREDATOR;
+// NULL when the section runs past the end of the data.
+const uint8_t* snapshot_get(SnapshotCursor* c, size_t size) {
+	size_t at = c->at;
+	c->at = (at + size + 7) & ~size_t(7);
+	return at <= c->size && size <= c->size - at ? c->data + at : NULL;
+}
 
-	en->health = PREDATOR_HP;
+// Every index set, in the order the header counts them.
+template <typename F>
+void snapshot_each_set(F fn) {
+	for (int prop = 0; prop < EP_COUNT; prop++) fn(&state->prop_index[prop]);
+	for (int type = 0; type < ET_COUNT; type++) fn(&state->type_index[type]);
+	fn(&state->free_flowers);
+}
 
-	PredatorData *data = (PredatorData*)arena_alloc(&arena, sizeof(PredatorData));
-	data->handle = -1;
-	data->attack_time = 1.f;
-	en->user_data = data;
-	return en;
+// Writes the snapshot to out and returns its size; pass NULL to only
+// measure.
+size_t snapshot_write(uint8_t* out) {
+	int cap = state->entity_cap;
+	SnapshotCursor c = {out, 0, 0};
+	SnapshotHeader header = {
+		.magic = SNAPSHOT_MAGIC,
+		.version = SNAPSHOT_VERSION,
+		.entity_size = sizeof(Entity),
+		.entity_cap = cap,
+		.free_count = state->free_count,
+		.live_count = state->live_count,
+		.spawn_failures = state->spawn_failures,
+		.player = en_handle(state->player),
+		.predator = state->predator,
+		.fireball_serial = state->fireball_serial,
+		.flower_cnt = state->flower_cnt,
+		.dt_speed = state->dt_speed,
+		.time_for_predator = state->time_for_predator,
+		.flower_spawn_time = flower_spawn_time,
+		.sim_accumulator = sim_accumulator,
+		.grid_max_extent = state->grid.max_extent,
+		.in_predator = in_predator,
+		.show_thing_ui = state->show_thing_ui,
+		.show_begin_message = state->show_begin_message,
+		.lost = state->lost,
+		.win = state->win,
+	};
+	for (int type = 0; type < ET_COUNT; type++) {
+		header.payload_size[type] = state->pools[type].item_size;
+	}
+	memcpy(header.rng, state->rng, sizeof(header.rng));
+	int set = 0;
+	snapshot_each_set([&](SparseSet* s) { header.set_count[set++] = s->count; });
+	snapshot_put(&c, &header, sizeof(header));
+
+	snapshot_put(&c, state->pos, sizeof(Vector2) * cap);
+	snapshot_put(&c, state->size, sizeof(Vector2) * cap);
+	snapshot_put(&c, state->type, sizeof(uint8_t) * cap);
+	snapshot_put(&c, state->alive, sizeof(uint64_t) * alive_words(cap));
+	size_t entities_at = snapshot_put(&c, NULL, 0);
+	c.at += sizeof(Entity) * cap;
+	snapshot_put(&c, state->free_slots, sizeof(int) * state->free_count);
+	snapshot_each_set([&](SparseSet* s) { snapshot_put(&c, s->dense, sizeof(int) * s->count); });
+	SpatialGrid* grid = &state->grid;
+	snapshot_put(&c, grid->heads, sizeof(int) * GRID_BUCKETS);
+	snapshot_put(&c, grid->next, sizeof(int) * cap);
+	snapshot_put(&c, grid->prev, sizeof(int) * cap);
+	snapshot_put(&c, grid->bucket, sizeof(int) * cap);
+	snapshot_put(&c, grid->cell, sizeof(uint64_t) * cap);
+
+	// Entity records, with user_data swapped for the payload's offset. The
+	// payloads follow.
+	for (int chunk = 0; chunk < cap >> ENTITY_CHUNK_SHIFT; chunk++) {
+		Entity* src = state->entity_chunks[chunk];
+		Entity* dst = out ? (Entity*)(out + entities_at) + (chunk << ENTITY_CHUNK_SHIFT) : nullptr;
+		if (dst) memcpy(dst, src, sizeof(Entity) * ENTITY_CHUNK);
+		for (int k = 0; k < ENTITY_CHUNK; k++) {
+			if (!src[k].user_data) continue;
+			size_t offset = snapshot_put(&c, src[k].user_data, state->pools[state->type[src[k].handle]].item_size);
+			if (dst) dst[k].user_data = (rawptr)(uintptr_t)offset;
+		}
+	}
+
+	if (out) ((SnapshotHeader*)out)->size = c.at;
+	return c.at;
 }
 
-// :predator
-void en_predator_update(Entity* self) {
-	
-	PredatorData *data = (PredatorData*)self->user_data;
-	
-	if (data->handle == -1) {
-		while (data->handle == -1) {
-			ListEntity defense = get_all_with_prop(EP_ATTACKABLE, &temp_arena);
-			if(defense.count == 1) {
-				data->handle = defense.items[0].handle;
-				break;
-			} else {
-				int rnd_idx = GetRandomValue(0, defense.count - 1);
-				if (defense.items[rnd_idx].type == ET_THING) {continue;}
-				data->handle = defense.items[rnd_idx].handle;
-				break;
-			}
+#define snapshot_index_ok(i, n) ((i) >= 0 && (i) < (n))
+#define snapshot_link_ok(i, n) ((i) >= -1 && (i) < (n))
+// A bool's byte must be 0 or 1 to be read back as one.
+#define snapshot_flag_ok(b) (*(const uint8_t*)&(b) <= 1)
+
+// Walks the sections the header describes and checks that each lies
+// inside the file and every slot index, link and payload offset in them is
+// in range, so snapshot_read can copy without further checks.
+bool snapshot_check(const uint8_t* data, size_t size, const SnapshotHeader* header) {
+	int saved = header->entity_cap;
+	if (saved <= 0 || saved % ENTITY_CHUNK != 0 || saved > MAX_ENTITY_CHUNKS * ENTITY_CHUNK) return false;
+	if (!snapshot_index_ok(header->free_count, saved + 1) || !snapshot_index_ok(header->live_count, saved + 1)) return false;
+	for (int set = 0; set < SNAPSHOT_SETS; set++) {
+		if (!snapshot_index_ok(header->set_count[set], saved + 1)) return false;
+	}
+	if (!snapshot_flag_ok(header->in_predator) || !snapshot_flag_ok(header->show_thing_ui) || !snapshot_flag_ok(header->show_begin_message)
+			|| !snapshot_flag_ok(header->lost) || !snapshot_flag_ok(header->win)) return false;
+
+	SnapshotCursor c = {(uint8_t*)data, 0, size};
+	snapshot_get(&c, sizeof(SnapshotHeader));
+	bool in_file = snapshot_get(&c, sizeof(Vector2) * saved) && snapshot_get(&c, sizeof(Vector2) * saved);
+	const uint8_t* type = snapshot_get(&c, sizeof(uint8_t) * saved);
+	const uint64_t* alive = (const uint64_t*)snapshot_get(&c, sizeof(uint64_t) * alive_words(saved));
+	const Entity* entities = (const Entity*)snapshot_get(&c, sizeof(Entity) * saved);
+	const int* free_slots = (const int*)snapshot_get(&c, sizeof(int) * header->free_count);
+	in_file = in_file && type && alive && entities && free_slots;
+	const int* dense[SNAPSHOT_SETS];
+	for (int set = 0; set < SNAPSHOT_SETS; set++) {
+		dense[set] = (const int*)snapshot_get(&c, sizeof(int) * header->set_count[set]);
+		in_file = in_file && dense[set];
+	}
+	const int* heads = (const int*)snapshot_get(&c, sizeof(int) * GRID_BUCKETS);
+	const int* next = (const int*)snapshot_get(&c, sizeof(int) * saved);
+	const int* prev = (const int*)snapshot_get(&c, sizeof(int) * saved);
+	const int* bucket = (const int*)snapshot_get(&c, sizeof(int) * saved);
+	if (!in_file || !heads || !next || !prev || !bucket || !snapshot_get(&c, sizeof(uint64_t) * saved)) return false;
+	// Payloads start here.
+	size_t payloads_at = c.at;
+
+	for (int i = 0; i < header->free_count; i++) {
+		if (!snapshot_index_ok(free_slots[i], saved)) return false;
+	}
+	for (int set = 0; set < SNAPSHOT_SETS; set++) {
+		for (int k = 0; k < header->set_count[set]; k++) {
+			if (!snapshot_index_ok(dense[set][k], saved)) return false;
 		}
 	}
+	for (int b = 0; b < GRID_BUCKETS; b++) {
+		if (!snapshot_link_ok(heads[b], saved)) return false;
+	}
+	for (int i = 0; i < saved; i++) {
+		if (type[i] >= ET_COUNT || entities[i].handle != i) return false;
+		if (!snapshot_flag_ok(entities[i].was_selected) || !snapshot_flag_ok(entities[i].attacked)) return false;
+		if (!snapshot_link_ok(bucket[i], GRID_BUCKETS)) return false;
+		// Links of slots outside the grid are stale and never followed.
+		if (bucket[i] >= 0 && (!snapshot_link_ok(next[i], saved) || !snapshot_link_ok(prev[i], saved))) return false;
+		if (!entities[i].user_data) continue;
+		bool is_alive = (alive[i >> 6] >> (i & 63)) & 1;
+		size_t offset = (size_t)(uintptr_t)entities[i].user_data;
+		uint32_t payload_size = header->payload_size[type[i]];
+		if (!is_alive || payload_size == 0 || offset < payloads_at || offset > size || payload_size > size - offset) return false;
+	}
 
-	if (!state->entities[data->handle].valid) {
-		data->handle = -1;
-		return;
+	// The player is resolved and its payload used straight away.
+	EntityHandle player = header->player;
+	return snapshot_index_ok(player.index, saved) && ((alive[player.index >> 6] >> (player.index & 63)) & 1)
+		&& type[player.index] == ET_THING && entities[player.index].user_data
+		&& entities[player.index].generation == player.generation;
+}
+
+// Replaces the current session with the snapshot in data. Storage grows to
+// the saved capacity if needed; current payloads go back to their pools.
+// Nothing is touched unless the whole file checks out.
+bool snapshot_read(const uint8_t* data, size_t size) {
+	SnapshotHeader header = {};
+	if (size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+	bool valid = header.magic == SNAPSHOT_MAGIC && header.version == SNAPSHOT_VERSION
+		&& header.entity_size == sizeof(Entity) && header.size == size;
+	for (int type = 0; valid && type < ET_COUNT; type++) {
+		int item_size = state->pools[type].item_size;
+		valid = item_size == 0 || header.payload_size[type] == 0 || int(header.payload_size[type]) == item_size;
+	}
+	valid = valid && snapshot_check(data, size, &header);
+	if (!valid) {
+		TraceLog(LOG_WARNING, "Not a valid version %d snapshot", SNAPSHOT_VERSION);
+		return false;
 	}
 
-	self->pos = Vector2MoveTowards(self->pos, state->entities[data->handle].pos, 60 * state->dt);
+	for (int i : en_all()) {
+		Entity* en = en_at(i);
+		if (en->user_data) pool_free(&state->pools[state->type[i]], en->user_data);
+	}
+	entities_reserve(header.entity_cap);
+	int saved = header.entity_cap;
+	int cap = state->entity_cap;
+
+	SnapshotCursor c = {(uint8_t*)data, 0, size};
+	snapshot_get(&c, sizeof(header));
+	memcpy(state->pos, snapshot_get(&c, sizeof(Vector2) * saved), sizeof(Vector2) * saved);
+	memcpy(state->size, snapshot_get(&c, sizeof(Vector2) * saved), sizeof(Vector2) * saved);
+	memcpy(state->type, snapshot_get(&c, sizeof(uint8_t) * saved), sizeof(uint8_t) * saved);
+	memcpy(state->alive, snapshot_get(&c, sizeof(uint64_t) * alive_words(saved)), sizeof(uint64_t) * alive_words(saved));
+	memset(state->type + saved, 0, sizeof(uint8_t) * (cap - saved));
+	memset(state->alive + alive_words(saved), 0, sizeof(uint64_t) * (alive_words(cap) - alive_words(saved)));
+
+	const Entity* entities = (const Entity*)snapshot_get(&c, sizeof(Entity) * saved);
+	for (int chunk = 0; chunk < cap >> ENTITY_CHUNK_SHIFT; chunk++) {
+		Entity* dst = state->entity_chunks[chunk];
+		if (chunk < saved >> ENTITY_CHUNK_SHIFT) {
+			memcpy(dst, entities + (chunk << ENTITY_CHUNK_SHIFT), sizeof(Entity) * ENTITY_CHUNK);
+		} else {
+			memset(dst, 0, sizeof(Entity) * ENTITY_CHUNK);
+			for (int k = 0; k < ENTITY_CHUNK; k++) {
+				dst[k].handle = (chunk << ENTITY_CHUNK_SHIFT) + k;
+			}
+		}
+	}
 
-	data->attack_time -= state->dt;
-	if (CheckCollisionRecs(en_box(*self), en_box(state->entities[data->handle])) && data->attack_time < 0) {
-		Entity *en = &state->entities[data->handle];
-		en->health -= 1;
-		data->attack_time = 1;
-		en->attacked = true;
+	// Slots the saved session never had sit under its free stack, lowest
+	// on top, where growing would have put them.
+	state->free_count = 0;
+	for (int i = cap - 1; i >= saved; i--) {
+		state->free_slots[state->free_count++] = i;
 	}
+	memcpy(state->free_slots + state->free_count, snapshot_get(&c, sizeof(int) * header.free_count), sizeof(int) * header.free_count);
+	state->free_count += header.free_count;
+
+	int set = 0;
+	snapshot_each_set([&](SparseSet* s) {
+		s->count = header.set_count[set++];
+		memcpy(s->dense, snapshot_get(&c, sizeof(int) * s->count), sizeof(int) * s->count);
+		for (int k = 0; k < s->count; k++) {
+			s->sparse[s->dense[k]] = k;
+		}
+	});
 
-	if (self->health <= 0) {
-		state->win = true;
-		en_invalidate(self);
+	SpatialGrid* grid = &state->grid;
+	memcpy(grid->heads, snapshot_get(&c, sizeof(int) * GRID_BUCKETS), sizeof(int) * GRID_BUCKETS);
+	memcpy(grid->next, snapshot_get(&c, sizeof(int) * saved), sizeof(int) * saved);
+	memcpy(grid->prev, snapshot_get(&c, sizeof(int) * saved), sizeof(int) * saved);
+	memcpy(grid->bucket, snapshot_get(&c, sizeof(int) * saved), sizeof(int) * saved);
+	memcpy(grid->cell, snapshot_get(&c, sizeof(uint64_t) * saved), sizeof(uint64_t) * saved);
+	memset(grid->bucket + saved, 0xFF, sizeof(int) * (cap - saved));
+	grid->max_extent = header.grid_max_extent;
+
+	// The one fixup pass: payload offsets back to pool memory.
+	for (int i : en_all()) {
+		Entity* en = en_at(i);
+		if (!en->user_data) continue;
+		size_t offset = (size_t)(uintptr_t)en->user_data;
+		uint32_t payload_size = header.payload_size[state->type[i]];
+		en->user_data = nullptr;
+		memcpy(en_alloc_data_(en, payload_size), data + offset, payload_size);
 	}
+
+	state->live_count = header.live_count;
+	state->spawn_failures = header.spawn_failures;
+	memcpy(state->rng, header.rng, sizeof(header.rng));
+	state->fireball_serial = header.fireball_serial;
+	state->flower_cnt = header.flower_cnt;
+	state->dt_speed = header.dt_speed;
+	state->time_for_predator = header.time_for_predator;
+	state->show_thing_ui = header.show_thing_ui;
+	state->show_begin_message = header.show_begin_message;
+	state->lost = header.lost;
+	state->win = header.win;
+	flower_spawn_time = header.flower_spawn_time;
+	sim_accumulator = header.sim_accumulator;
+	in_predator = header.in_predator;
+	state->player = en_resolve(header.player);
+	state->thing_data = (ThingData*)state->player->user_data;
+	state->predator = header.predator;
+	return true;
 }
 
-// :predator
-void en_predator_render(Entity self) {
-	push_layer(L_DEBUG_COL);
-	draw_texture_v2(PREDATOR, self.pos);
-	pop_layer();
+bool snapshot_save(const char* path) {
+	Arena scratch = {};
+	size_t size = snapshot_write(NULL);
+	uint8_t* data = (uint8_t*)arena_alloc(&scratch, size);
+	snapshot_write(data);
+	bool saved = SaveFileData(path, data, int(size));
+	arena_free(&scratch);
+	if (!saved) TraceLog(LOG_WARNING, "Failed to save snapshot %s", path);
+	return saved;
 }
 
-struct WorkerData {
-	Task task;
-	int handle;
+bool snapshot_load(const char* path) {
+	size_t size = 0;
+	uint8_t* data = (uint8_t*)map_file(path, &size);
+	if (!data) {
+		TraceLog(LOG_WARNING, "Failed to open snapshot %s", path);
+		return false;
+	}
+	bool loaded = snapshot_read(data, size);
+	unmap_file(data, size);
+	return loaded;
+}
+// ;snapshot
+
+// :bundle
+// res/ baked into one file by --pack: the atlas as raw RGBA8, sounds as
+// decoded PCM and music as the original OGG bytes (it is streamed), behind a
+// table of contents. At startup the bundle is mapped and stays mapped, since
+// music streams decode from it while playing. The loader takes assets from
+// it when present and from res/ otherwise.
+#define BUNDLE_MAGIC 0x4e42444c // "LDBN"
+#define BUNDLE_VERSION 1
+#define BUNDLE_PATH "res.bundle"
+#define BUNDLE_NAME_SIZE 32
+// Each asset's data starts on this boundary.
+#define BUNDLE_ALIGN 16
+
+enum BundleKind {
+	BUNDLE_IMAGE,
+	BUNDLE_WAVE,
+	BUNDLE_RAW,
 };
 
-// :workers
-Entity* en_worker(Vector2 pos, Task task) {
-	Entity* en = new_en();
-
-	en_setup(en, pos, v2of(10));
+struct BundleHeader {
+	uint32_t magic;
+	uint32_t version;
+	uint32_t entry_count;
+	uint32_t pad;
+	uint64_t size;
+};
 
-	en->type = ET_WORKER;
+struct BundleEntry {
+	char name[BUNDLE_NAME_SIZE];
+	uint32_t kind;
+	// Image: width, height. Wave: frame count, sample rate, sample size,
+	// channels.
+	int32_t params[4];
+	uint64_t offset;
+	uint64_t size;
+};
 
-	WorkerData* data = (WorkerData*)arena_alloc(&arena, sizeof(WorkerData));
-	data->task = task;
-	data->handle = -1;
-	en->user_data = data;
+struct BundleAsset {
+	const char* name;
+	BundleKind kind;
+};
 
-	return en;
-}
+BundleAsset bundle_assets[] = {
+	{"atlas.png", BUNDLE_IMAGE},
+	{"btn_click.wav", BUNDLE_WAVE},
+	{"remove_flower.wav", BUNDLE_WAVE},
+	{"hover.wav", BUNDLE_WAVE},
+	{"shoot.wav", BUNDLE_WAVE},
+	{"died.wav", BUNDLE_WAVE},
+	{"loop_1.ogg", BUNDLE_RAW},
+	{"predator.ogg", BUNDLE_RAW},
+};
 
+#define BUNDLE_ASSET_COUNT int(sizeof(bundle_assets) / sizeof(bundle_assets[0]))
 
-// :worker
-void en_worker_update(Entity* self) {
+struct Bundle {
+	uint8_t* data;
+	size_t size;
+	const BundleEntry* entries;
+	int count;
+};
 
-	WorkerData* data = (WorkerData*)self->user_data;
-	ThingData* thing_data = (ThingData*)state->player->user_data;
+Bundle bundle = {};
+
+// Whether entry's data lies inside the size bytes mapped after data_at and
+// matches what its kind and params say it holds.
+bool bundle_entry_ok(const BundleEntry* entry, size_t data_at, size_t size) {
+	if (memchr(entry->name, 0, BUNDLE_NAME_SIZE) == NULL) return false;
+	if (entry->offset < data_at || entry->offset % BUNDLE_ALIGN != 0 || entry->offset > size || entry->size > size - entry->offset) return false;
+	const int32_t* params = entry->params;
+	switch (entry->kind) {
+		case BUNDLE_IMAGE:
+			return params[0] > 0 && params[1] > 0 && uint64_t(params[0]) * uint64_t(params[1]) * 4 == entry->size;
+		case BUNDLE_WAVE:
+			return params[0] > 0 && params[1] > 0 && (params[2] == 8 || params[2] == 16 || params[2] == 32)
+				&& params[3] > 0 && uint64_t(params[0]) * uint64_t(params[3]) * uint64_t(params[2] / 8) == entry->size;
+		case BUNDLE_RAW:
+			return entry->size <= INT_MAX;
+	}
+	return false;
+}
 
-	if (data->handle == -1 && fdata.flowers.count > 0) {
-		int rnd_idx = GetRandomValue(0, fdata.flowers.count - 1);
-		data->handle = fdata.flowers.items[rnd_idx].handle;
-		state->entities[data->handle].was_selected = true;
+bool bundle_open(const char* path) {
+	size_t size = 0;
+	uint8_t* data = (uint8_t*)map_file(path, &size);
+	if (!data) return false;
+	BundleHeader header = {};
+	if (size >= sizeof(header)) memcpy(&header, data, sizeof(header));
+	size_t data_at = sizeof(header) + sizeof(BundleEntry) * size_t(header.entry_count);
+	bool valid = header.magic == BUNDLE_MAGIC && header.version == BUNDLE_VERSION && header.size == size && data_at <= size;
+	const BundleEntry* entries = (const BundleEntry*)(data + sizeof(header));
+	for (uint32_t i = 0; valid && i < header.entry_count; i++) {
+		valid = bundle_entry_ok(&entries[i], data_at, size);
+	}
+	if (!valid) {
+		TraceLog(LOG_WARNING, "%s is not a version %d bundle, loading from res/", path, BUNDLE_VERSION);
+		unmap_file(data, size);
+		return false;
 	}
+	bundle = {data, size, entries, int(header.entry_count)};
+	return true;
+}
 
-	if (data->handle != -1 && state->entities[data->handle].valid) {
+const BundleEntry* bundle_find(const char* name) {
+	for (int i = 0; i < bundle.count; i++) {
+		if (strncmp(bundle.entries[i].name, name, BUNDLE_NAME_SIZE) == 0) return &bundle.entries[i];
+	}
+	return nullptr;
+}
 
-		self->pos = Vector2MoveTowards(self->pos, state->entities[data->handle].pos, 100 * state->dt);
+// Decodes everything in bundle_assets from res/ and writes the bundle.
+int run_pack(const char* path) {
+	BundleEntry entries[BUNDLE_ASSET_COUNT] = {};
+	const void* data[BUNDLE_ASSET_COUNT] = {};
+	Image images[BUNDLE_ASSET_COUNT] = {};
+	Wave waves[BUNDLE_ASSET_COUNT] = {};
+	unsigned char* raws[BUNDLE_ASSET_COUNT] = {};
+
+	size_t at = sizeof(BundleHeader) + sizeof(entries);
+	bool ok = true;
+	for (int i = 0; i < BUNDLE_ASSET_COUNT; i++) {
+		BundleAsset asset = bundle_assets[i];
+		const char* file = TextFormat("./res/%s", asset.name);
+		BundleEntry* entry = &entries[i];
+		strncpy(entry->name, asset.name, BUNDLE_NAME_SIZE - 1);
+		entry->kind = asset.kind;
+		switch (asset.kind) {
+			case BUNDLE_IMAGE:
+				images[i] = LoadImage(file);
+				ImageFormat(&images[i], PIXELFORMAT_UNCOMPRESSED_R8G8B8A8);
+				entry->params[0] = images[i].width;
+				entry->params[1] = images[i].height;
+				entry->size = size_t(images[i].width) * images[i].height * 4;
+				data[i] = images[i].data;
+				break;
+			case BUNDLE_WAVE:
+				waves[i] = LoadWave(file);
+				entry->params[0] = int(waves[i].frameCount);
+				entry->params[1] = int(waves[i].sampleRate);
+				entry->params[2] = int(waves[i].sampleSize);
+				entry->params[3] = int(waves[i].channels);
+				entry->size = size_t(waves[i].frameCount) * waves[i].channels * (waves[i].sampleSize / 8);
+				data[i] = waves[i].data;
+				break;
+			case BUNDLE_RAW: {
+				int size = 0;
+				raws[i] = LoadFileData(file, &size);
+				entry->size = size_t(size);
+				data[i] = raws[i];
+			} break;
+		}
+		if (!data[i]) {
+			fprintf(stderr, "pack: failed to load %s\n", file);
+			ok = false;
+		}
+		at = (at + BUNDLE_ALIGN - 1) & ~size_t(BUNDLE_ALIGN - 1);
+		entry->offset = at;
+		at += entry->size;
+	}
 
-		if (Vector2Equals(self->pos, state->entities[data->handle].pos)) {
-			en_invalidate(&state->entities[data->handle]);
-			en_invalidate(self);
-			state->flower_cnt -= 1;
-			PlaySound(state->remove_flower);
-			thing_data->food_amt += GetRandomValue(2, 5);	
+	if (ok) {
+		Arena scratch = {};
+		uint8_t* out = (uint8_t*)arena_alloc(&scratch, at);
+		memset(out, 0, at);
+		BundleHeader header = {BUNDLE_MAGIC, BUNDLE_VERSION, uint32_t(BUNDLE_ASSET_COUNT), 0, at};
+		memcpy(out, &header, sizeof(header));
+		memcpy(out + sizeof(header), entries, sizeof(entries));
+		for (int i = 0; i < BUNDLE_ASSET_COUNT; i++) {
+			memcpy(out + entries[i].offset, data[i], entries[i].size);
 		}
+		ok = SaveFileData(path, out, int(at));
+		arena_free(&scratch);
+		if (ok) printf("pack: %d assets, %zu bytes to %s\n", BUNDLE_ASSET_COUNT, at, path);
 	}
-}
 
-// :worker
-void en_worker_render(Entity self) {
-	push_layer(L_WORKER);
-	draw_texture_v2(WORKER_ICON, self.pos);
-	pop_layer();
+	for (int i = 0; i < BUNDLE_ASSET_COUNT; i++) {
+		if (images[i].data) UnloadImage(images[i]);
+		if (waves[i].data) UnloadWave(waves[i]);
+		if (raws[i]) UnloadFileData(raws[i]);
+	}
+	return ok ? 0 : 1;
 }
+// ;bundle
+
+// :loader
+// Assets are queued up front, decoded in order on a loader thread and
+// uploaded on the main thread a few per frame by loader_update, so the
+// window keeps drawing a loading screen meanwhile. An AssetId resolves
+// once loader_finished. The web build has no thread and decodes inline,
+// one asset per upload.
+#define MAX_ASSETS 32
+// Main-thread time per frame spent creating textures and sounds.
+#define LOADER_SLICE_MS 4.0
+
+enum AssetKind {
+	ASSET_TEXTURE,
+	ASSET_SOUND,
+	ASSET_MUSIC,
+};
 
-#define PERFORM_TASK_TIME .8f
-#define WORKER_AMT 20
-#define START_FOOD_AMT 100
-
-// :thing
-Entity* en_thing(Vector2 pos, Vector2 size) {
-	Entity* en = new_en();
-
-	en_setup(en, pos, size);
-	en->type = ET_THING;
+struct AssetId {
+	int index;
+};
 
-	ThingData* data = (ThingData*)arena_alloc(&arena, sizeof(ThingData));
-	memset(data, 0, sizeof(ThingData));
-	data->perform_task_time = PERFORM_TASK_TIME;
-	data->current_task = TASK_NONE;
-	data->worker_amt = WORKER_AMT;
-	data->food_amt = START_FOOD_AMT;
+struct Asset {
+	const char* name;
+	AssetKind kind;
+	// Filled by the decode step. Owned data is released after upload,
+	// except music bytes, which the stream keeps reading.
+	Image image;
+	Wave wave;
+	const unsigned char* bytes;
+	int byte_count;
+	bool owned;
+	// Filled by the upload step.
+	Texture2D texture;
+	Sound sound;
+	Music music;
+};
 
-	en->user_data = data;
-	en->health = 100;
+struct Loader {
+	Asset assets[MAX_ASSETS];
+	int count;
+	// Assets [0, decoded) are ready to upload, [0, uploaded) are done.
+	std::atomic<int> decoded;
+	int uploaded;
+	std::thread thread;
+	std::chrono::steady_clock::time_point start;
+};
 
-	en_add_props(en, {EP_ATTACKABLE});
+Loader loader = {};
 
-	return en;
+AssetId queue_asset(const char* name, AssetKind kind) {
+	assert(loader.count < MAX_ASSETS && "raise MAX_ASSETS");
+	Asset* asset = &loader.assets[loader.count];
+	asset->name = name;
+	asset->kind = kind;
+	return {loader.count++};
 }
 
-// :thing
-void en_thing_update(Entity* self) {
-
-	ThingData* data = (ThingData*)self->user_data;
-	
-	switch (data->current_task) {
-		case TASK_NONE:
+// Runs on the loader thread: no GPU or audio calls, and no TextFormat
+// since its buffers are shared with the main thread.
+void asset_decode(Asset* asset) {
+	const BundleEntry* entry = bundle_find(asset->name);
+	char path[256];
+	snprintf(path, sizeof(path), "./res/%s", asset->name);
+	switch (asset->kind) {
+		case ASSET_TEXTURE:
+			if (entry && entry->kind == BUNDLE_IMAGE) {
+				asset->image = {
+					.data = bundle.data + entry->offset,
+					.width = entry->params[0],
+					.height = entry->params[1],
+					.mipmaps = 1,
+					.format = PIXELFORMAT_UNCOMPRESSED_R8G8B8A8,
+				};
+			} else {
+				asset->image = LoadImage(path);
+				asset->owned = true;
+			}
 			break;
-		case TASK_COLLECT:
-			if(data->worker_amt > 0) {
-				data->perform_task_time -= state->dt * state->dt_speed;
-				if (data->perform_task_time < 0 && fdata.flowers.count > 0) {
-					en_worker(en_center(*self), data->current_task);
-					data->perform_task_time = PERFORM_TASK_TIME;
-					data->worker_amt -= 1;
-					data->food_amt -= 1;
-				}
+		case ASSET_SOUND:
+			if (entry && entry->kind == BUNDLE_WAVE) {
+				asset->wave = {
+					.frameCount = (unsigned int)entry->params[0],
+					.sampleRate = (unsigned int)entry->params[1],
+					.sampleSize = (unsigned int)entry->params[2],
+					.channels = (unsigned int)entry->params[3],
+					.data = bundle.data + entry->offset,
+				};
 			} else {
-				data->current_task = TASK_NONE;
-				data->worker_amt = data->last_worker_amt;
+				asset->wave = LoadWave(path);
+				asset->owned = true;
 			}
 			break;
-		case TASK_DEFENSE:
-		{
-			data->food_amt -= 200;
-			data->worker_amt -= 10;
-			Vector2 pos = v2(
-					GetRandomValue(-RENDER_SIZE.x/2, RENDER_SIZE.x/2),
-					GetRandomValue(-RENDER_SIZE.y/2, RENDER_SIZE.y/2)
-			);
-		
-			bool in_player = CheckCollisionPointRec(pos, to_rect(v4v2(self->pos, v2(48, 64))));
-			
-			en_defense(pos, v2(DEFENSE_BUILDING.z, DEFENSE_BUILDING.w));
+		case ASSET_MUSIC:
+			if (entry && entry->kind == BUNDLE_RAW) {
+				asset->bytes = bundle.data + entry->offset;
+				asset->byte_count = int(entry->size);
+			} else {
+				asset->bytes = LoadFileData(path, &asset->byte_count);
+			}
+			break;
+	}
+}
 
-			data->current_task = TASK_NONE;
-		}
-		break;
-		case TASK_REPRODUCE:
-		{
-			data->food_amt -= 2 * (data->worker_amt / 2);
-			data->worker_amt += data->worker_amt / 2;
-			data->current_task = TASK_NONE;
-		}
-		break;
+void asset_upload(Asset* asset) {
+	switch (asset->kind) {
+		case ASSET_TEXTURE:
+			asset->texture = LoadTextureFromImage(asset->image);
+			if (asset->owned) UnloadImage(asset->image);
+			asset->image = {};
+			break;
+		case ASSET_SOUND:
+			asset->sound = LoadSoundFromWave(asset->wave);
+			if (asset->owned) UnloadWave(asset->wave);
+			asset->wave = {};
+			break;
+		case ASSET_MUSIC:
+			asset->music = LoadMusicStreamFromMemory(GetFileExtension(asset->name), asset->bytes, asset->byte_count);
+			break;
 	}
+}
 
-	if (self->health <= 0) {
-		state->lost = true;
+void loader_thread() {
+	for (int i = 0; i < loader.count; i++) {
+		asset_decode(&loader.assets[i]);
+		loader.decoded.store(i + 1, std::memory_order_release);
 	}
+}
 
-	if (self->attacked) {
-		ListEntity def = get_all_with_prop(EP_ATTACKABLE);
-		if (def.count == 1) {
-			state->lost = true;
-		}
+// Call once everything is queued.
+void loader_start() {
+	loader.start = std::chrono::steady_clock::now();
+#if !defined(PLATFORM_WEB)
+	loader.thread = std::thread(loader_thread);
+#endif
+}
+
+bool loader_finished() {
+	return loader.uploaded == loader.count;
+}
+
+// Uploads decoded assets until the slice is used up; at least one per call.
+void loader_update(double slice_ms) {
+	auto start = std::chrono::steady_clock::now();
+	while (loader.uploaded < loader.count) {
+#if defined(PLATFORM_WEB)
+		asset_decode(&loader.assets[loader.uploaded]);
+#else
+		if (loader.uploaded == loader.decoded.load(std::memory_order_acquire)) break;
+#endif
+		asset_upload(&loader.assets[loader.uploaded++]);
+		if (std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - start).count() >= slice_ms) break;
+	}
+	if (loader_finished() && loader.thread.joinable()) {
+		loader.thread.join();
 	}
 }
 
-// :thing
-void en_thing_render(Entity self) {
-	push_layer(L_DEBUG_COL);
-	draw_texture_v2(THING, self.pos);
-	pop_layer();
-	draw_texture_v2(THING_SPOT, {(self.pos.x + (self.size.x - THING_SPOT.z) * .5f), (self.pos.y + self.size.y / 2)});
+Texture2D asset_texture(AssetId id) {
+	assert(id.index < loader.uploaded && "asset not loaded yet");
+	return loader.assets[id.index].texture;
 }
 
+Sound asset_sound(AssetId id) {
+	assert(id.index < loader.uploaded && "asset not loaded yet");
+	return loader.assets[id.index].sound;
+}
 
+Music asset_music(AssetId id) {
+	assert(id.index < loader.uploaded && "asset not loaded yet");
+	return loader.assets[id.index].music;
+}
 
-bool ui_btn(Vector2 pos, const char* text, float text_size, bool can_click = true) {
+void loading_screen() {
+	BeginDrawing();
+	ClearBackground(BLACK);
+	float progress = loader.count > 0 ? float(loader.uploaded) / loader.count : 1.f;
+	Vector2 bar_size = v2(WINDOW_SIZE.x / 3, 8);
+	Vector2 bar_pos = (WINDOW_SIZE - bar_size) / 2;
+	DrawRectangleLinesEx(to_rect(v4v2(bar_pos, bar_size)), 1, GRAY);
+	DrawRectangleV(bar_pos, v2(bar_size.x * progress, bar_size.y), WHITE);
+	const char* label = TextFormat("Loading %d/%d", loader.uploaded, loader.count);
+	DrawText(label, bar_pos.x, bar_pos.y - 30, 20, WHITE);
+	EndDrawing();
+}
+// ;loader
 
-	Vector4 dest = v4zw(96, 32);
-	dest.x = pos.x;
-	dest.y = pos.y;
+// :init
+void init_state(int budget, OverflowPolicy overflow) {
+	alloc_state(budget, overflow);
+	for (int stream = 0; stream < RNG_COUNT; stream++) {
+		state->rng[stream] = rng_make(session_seed, stream);
+	}
+	state->dt_speed = 1;	
+	state->cam = Camera2D{};
+	state->cam.zoom = 1.f;
+	state->cam.offset = RENDER_SIZE / v2of(2);
+	state->show_begin_message = true;
+	state->time_for_predator = 600;
+	state->lost = false;
+	state->win = false;
 
-	bool hover = false;
-	bool clicked = false;
+	Vector2 player_size = v2(48, 64);
+	player_pos = ZERO - (player_size / 2);
+	state->player = en_thing(player_pos, player_size);
+	state->thing_data = (ThingData*)state->player->user_data; 
 
-	if (CheckCollisionPointRec(state->virtual_mouse, to_rect(dest))) {
-		hover = true;
-		if (IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
-			clicked = true;
+	flower_spawn_time = .8;
+	
+	Vector2 flower_pos[256];
+	rng_fill_points(&state->rng[RNG_SPAWN], flower_pos, 256, SPAWN_AREA);
+	for (Vector2 pos : flower_pos) {
+		bool on_building = grid_overlap(rv2(pos, v2of(TILE_SIZE)), ET_BIT(ET_THING) | ET_BIT(ET_DEFENSE)) >= 0;
+		bool out_of_bounds = pos.x + 16 > RENDER_SIZE.x / 2 || pos.x < -RENDER_SIZE.x / 2 || pos.y + 16 > RENDER_SIZE.x / 2 || pos.y < -RENDER_SIZE.x / 2;
+		if(!on_building && !out_of_bounds) {
+			en_flower(pos);
 		}
 	}
+	state->flower_cnt = 256;
+}
 
-	float text_sz = MeasureText(text, text_size);
-	Vector2 text_pos = { 
-		(dest.z - text_sz) * .5f, 
-		(dest.w - text_size) * .5f,
+struct GameAssets {
+	AssetId atlas;
+	AssetId ui_click;
+	AssetId loop_1;
+	AssetId predator_music;
+	AssetId remove_flower;
+	AssetId hover;
+	AssetId shoot;
+	AssetId died;
+};
+
+GameAssets game_assets = {};
+
+void queue_game_assets() {
+	game_assets = {
+		.atlas = queue_asset("atlas.png", ASSET_TEXTURE),
+		.ui_click = queue_asset("btn_click.wav", ASSET_SOUND),
+		.loop_1 = queue_asset("loop_1.ogg", ASSET_MUSIC),
+		.predator_music = queue_asset("predator.ogg", ASSET_MUSIC),
+		.remove_flower = queue_asset("remove_flower.wav", ASSET_SOUND),
+		.hover = queue_asset("hover.wav", ASSET_SOUND),
+		.shoot = queue_asset("shoot.wav", ASSET_SOUND),
+		.died = queue_asset("died.wav", ASSET_SOUND),
 	};
+}
 
-	text_pos = xyv4(dest) + text_pos;
+// Runs once the loader has finished: everything that needs the assets. The
+// state itself is set up by main.
+void start_game() {
+	startup_assets_ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - loader.start).count();
+	Texture2D atlas = asset_texture(game_assets.atlas);
+	ui_click = asset_sound(game_assets.ui_click);
+	hover_sound = asset_sound(game_assets.hover);
+	loop_1 = asset_music(game_assets.loop_1);
+	predator_music = asset_music(game_assets.predator_music);
 
-	draw_texture_v2({128, hover ? 240.f : 208.f, 96, 32}, pos);
-	draw_text(text_pos, text, text_size);
+	renderer = (Renderer*)arena_alloc(&arena, sizeof(Renderer));
+	memset(renderer, 0, sizeof(Renderer));
+	renderer->layer_stack = {0};
+	renderer->current_layer = 0;
+	renderer->atlas = atlas;
+	renderer->batch = {};
+	renderer->batch.tex = atlas;
+	renderer->stats = {};
+	group_layer_textures(L_BACK);
+	group_layer_textures(L_FLOWER);
+	group_layer_textures(L_WORKER);
+	
+	state->remove_flower = asset_sound(game_assets.remove_flower);
+	state->shoot = asset_sound(game_assets.shoot);
+	state->died = asset_sound(game_assets.died);
 
-	if(!can_click) {
-		draw_quad(v4(pos.x, pos.y, 96, 32), ColorAlpha(GRAY, .8));
-	}
+	assert(renderer != NULL && "arena returned null");
 
-	return clicked && can_click;
+	music = loop_1;
+	PlayMusicStream(music);
 }
 
-Music loop_1;
-Music predator_music;
-Sound ui_click;
-Sound hover_sound;
-Music music;
-float volume = 0;
-float flower_spawn_time = 0.f;
-bool in_predator = false;
-Vector2 player_pos;
-RenderTexture2D game_texture;
-RenderTexture2D light_texture;
-RenderTexture2D ui_texture;
-
 void update_frame() {
+	if (!loader_finished()) {
+		loader_update(LOADER_SLICE_MS);
+		loading_screen();
+		if (loader_finished()) start_game();
+		return;
+	}
+
+	PROFILE_FRAME();
+	PROFILE_ZONE("frame");
 	UpdateMusicStream(music);
+	renderer->stats = {};
+	text_cache_begin_frame();
 		
 		if (volume < .7) {
 			volume = fminf(volume + 0.2 * GetFrameTime(), .7);
 			SetMusicVolume(music, volume);
 		}
 
-		state->dt = GetFrameTime();
-		state->dt *= state->dt_speed;
-
-		arena_reset(&temp_arena);
-		fdata.flowers = {0};
-
 		float scale = fmin(WINDOW_SIZE.x / RENDER_SIZE.x, WINDOW_SIZE.y / RENDER_SIZE.y);
 		state->virtual_mouse = (GetMousePosition() - (WINDOW_SIZE - (RENDER_SIZE * scale)) * .5) / scale;
 		state->virtual_mouse = Vector2Clamp(state->virtual_mouse, ZERO, RENDER_SIZE);
 
 		// :update
 		{
+			PROFILE_ZONE("update");
 			if (state->show_begin_message && IsKeyPressed(KEY_ENTER)) {
-				state->show_begin_message = false;
-				state->show_thing_ui = true;
-			}
-
-			if (state->thing_data->current_task == TASK_NONE && !state->show_begin_message && !in_predator) {
-				state->show_thing_ui = true;
-				state->dt_speed = 1;
+				queue_input({INPUT_START});
 			}
 
-			if (!state->show_thing_ui && !state->show_begin_message) {
-				state->time_for_predator -= state->dt * state->dt_speed;
-			}
-
-			if (state->time_for_predator <= 0) {
-				if (!in_predator) {
-					state->dt_speed = 1;
-					state->predator = en_predator(v2(0, -RENDER_SIZE.y / 2), v2(PREDATOR.z, PREDATOR.w));
-					StopMusicStream(music);
-					music = predator_music;
-					volume = 0.f;
-					PlayMusicStream(music);
-					in_predator =  true;
-				}
-			}
-
-			// :spawn
+			// :debug
 			{
-				flower_spawn_time -= state->dt * state->dt_speed;
-				if (flower_spawn_time < 0 && state->flower_cnt < 300) {
-					Vector2 pos = v2(
-							GetRandomValue(-RENDER_SIZE.x/2, RENDER_SIZE.x/2),
-							GetRandomValue(-RENDER_SIZE.y/2, RENDER_SIZE.y/2)
-					);
-		
-					bool in_player = CheckCollisionPointRec(pos, to_rect(v4v2(player_pos, v2(48, 64))));
-					bool out_of_bounds = pos.x + 16 > RENDER_SIZE.x / 2 || pos.x < -RENDER_SIZE.x / 2 || pos.y + 16 > RENDER_SIZE.x / 2 || pos.y < -RENDER_SIZE.x / 2;
-					if(!in_player && !out_of_bounds) {
-						en_flower(pos);
-						state->flower_cnt += 1;
-					}
-
-
-					flower_spawn_time = 2.f;
+				if(IsKeyPressed(KEY_K)) {
+					queue_input({INPUT_SPEED_UP});
+				} else if(IsKeyPressed(KEY_J)) {
+					queue_input({INPUT_SPEED_DOWN});
 				}
-			}
 
-			// :gather unselected flowers
-			{
-				for(Entity en : state->entities) {
-					if(en.valid && en.type == ET_FLOWER && !en.was_selected) {
-						arena_da_append(&temp_arena, &fdata.flowers, en);
-					}
+				// F5 saves a snapshot, F9 loads it back unless a replay is
+				// recording or playing, which loading would desync.
+				if (IsKeyPressed(KEY_F5)) {
+					snapshot_save(SNAPSHOT_PATH);
+				} else if (IsKeyPressed(KEY_F9) && replay.mode == REPLAY_OFF && snapshot_load(SNAPSHOT_PATH)) {
+					// The snapshot may be from the other side of the predator.
+					Music track = in_predator ? predator_music : loop_1;
+					if (music.stream.buffer != track.stream.buffer) switch_music(track);
 				}
 			}
 
-			// :debug
-			{
-				if(IsKeyPressed(KEY_K)) {
-					state->dt_speed += 1;
-				} else if(IsKeyPressed(KEY_J)) {
-					state->dt_speed -= 1;
-				}
+			bool was_in_predator = in_predator;
 
-				state->dt_speed = Clamp(state->dt_speed, 1, 10);
+			{
+				PROFILE_ZONE("step");
+				sim_frame(GetFrameTime());
 			}
 
-			for(int i = 0; i < MAX_ENTITIES; i++) {
-				Entity* en	= &state->entities[i];
-				if (!en->valid) { continue; };
-				switch (en->type) {
-					case ET_NONE:
-					case ET_FLOWER:
-						break;
-					case ET_DEFENSE:
-						en_defense_update(en);
-						break;
-					case ET_THING:
-						en_thing_update(en);
-						break;
-					case ET_WORKER:
-						en_worker_update(en);
-						break;
-					case ET_PREDATOR:
-						en_predator_update(en);
-						break;
-					case ET_FIREBALL:
-						en_fireball_update(en);
-						break;
-				}
+			if (in_predator && !was_in_predator) {
+				switch_music(predator_music);
 			}
 		}
 
@@ -1000,6 +3811,7 @@ void update_frame() {
 
 		// :game_render
 		{
+			PROFILE_ZONE("game_render");
 			BeginTextureMode(game_texture);
 			{
 				ClearBackground(BLACK);
@@ -1008,28 +3820,33 @@ void update_frame() {
 				{
 					// :entities
 					{
-						for (Entity en: state->entities) {
-							if (!en.valid) { continue; }
-							switch (en.type) {
+						PROFILE_ZONE("entities_render");
+						// Rendering spawns nothing, so a straight scan of the
+						// type array is safe, and free slots are ET_NONE. It beats
+						// walking the alive bits at every entity count.
+						const uint8_t* types = state->type;
+						int cap = state->entity_cap;
+						for (int i = 0; i < cap; i++) {
+							switch (types[i]) {
 								case ET_NONE:
 									break;
 								case ET_DEFENSE:
-									en_defense_render(en);
+									en_defense_render(i);
 									break;
 								case ET_FLOWER:
-									en_flower_render(en);
+									en_flower_render(i);
 									break;
 								case ET_THING:
-									en_thing_render(en);
+									en_thing_render(i);
 									break;
 								case ET_WORKER:
-									en_worker_render(en);
+									en_worker_render(i);
 									break;
 								case ET_PREDATOR:
-									en_predator_render(en);
+									en_predator_render(i);
 									break;
 								case ET_FIREBALL:
-									en_fireball_render(en);
+									en_fireball_render(i);
 									break;
 							}
 						}
@@ -1037,9 +3854,8 @@ void update_frame() {
 
 #if 0
 					push_layer(L_DEBUG_COL);
-					ListEntity collidables = get_all_with_prop(EP_COLLIDABLE, &temp_arena);
-					for(int i = 0; i < collidables.count; i++) {
-						draw_quad_lines(to_v4(en_box(collidables.items[i])));
+					for (Entity* en : query_prop(EP_COLLIDABLE)) {
+						draw_quad_lines(to_v4(en_box(en)));
 					}
 					pop_layer();
 #endif
@@ -1091,6 +3907,7 @@ void update_frame() {
 
 				// :ui
 				{
+					PROFILE_ZONE("ui");
 					if (state->show_thing_ui) {
 
 						Vector4 tasks = v4(0, 416, 446, 224);
@@ -1100,7 +3917,7 @@ void update_frame() {
 						dest.x = (RENDER_SIZE.x - dest.z) * .5f;
 						dest.y = (RENDER_SIZE.y - dest.w) * .5f;
 
-						float size = MeasureText("Perform task:", 20);
+						float size = measure_text("Perform task:", 20);
 						Vector4 title_dest = v4zw(size, 20);
 						start_of(dest, &title_dest);
 						pad(&title_dest, TOP, 10);
@@ -1126,15 +3943,15 @@ void update_frame() {
 							if (CheckCollisionPointRec(state->virtual_mouse, to_rect(collect))) {
 								collect = grow(collect, 5);
 								if (hover != i)
-									PlaySound(hover_sound);
+									play_sound(hover_sound);
 								hover = i;
 								if(IsMouseButtonPressed(MOUSE_BUTTON_LEFT)) {
 									selected = i;
-									PlaySound(ui_click);
+									play_sound(ui_click);
 								}
 							}
 							
-							Vector4 text_dest = v4zw(float(MeasureText(task_name[i], 10.f)), 10.f);
+							Vector4 text_dest = v4zw(float(measure_text(task_name[i], 10)), 10.f);
 							start_of(collect, &text_dest);
 							center(collect, &text_dest, 0);
 							center(collect, &text_dest, 1);
@@ -1158,21 +3975,11 @@ void update_frame() {
 						}
 
 						if(ui_btn(xyv4(confirm), "Confirm", 10, can_click)) {
-							PlaySound(ui_click);
-							ThingData* data = (ThingData*)state->player->user_data;
-							switch(selected) {
-								case 0:
-									data->current_task = TASK_COLLECT;
-									state->show_thing_ui = false;
-									break;
-								case 1:
-									data->current_task = TASK_DEFENSE;
-									state->show_thing_ui = false;
-									break;
-								case 2:
-									data->current_task = TASK_REPRODUCE;
+							play_sound(ui_click);
+							Task selected_task[3] = {TASK_COLLECT, TASK_DEFENSE, TASK_REPRODUCE};
+							if (selected >= 0) {
+								queue_input({INPUT_SET_TASK, uint8_t(selected_task[selected])});
 							}
-							data->last_worker_amt = data->worker_amt;
 						}
 
 						Vector4 other = {dest.x + 447, dest.y, 128, dest.w};
@@ -1196,7 +4003,7 @@ void update_frame() {
 								draw_texture_v2(FOOD_ICON, xyv4(food_icon_dest));
 
 								const char* food_cost_str = TextFormat("-%d/+~%d", state->thing_data->worker_amt, state->thing_data->worker_amt * 4);
-								float size = MeasureText(food_cost_str, 10);
+								float size = measure_text(food_cost_str, 10);
 								Vector4 food_cost = v4zw(size, 10);
 								start_of(other, &food_cost);
 								below(food_icon_dest, &food_cost);
@@ -1224,7 +4031,7 @@ void update_frame() {
 								draw_texture_v2(FOOD_ICON, xyv4(food_icon_dest));
 
 								const char* food_cost_str = TextFormat("-%d", 200);
-								float size = MeasureText(food_cost_str, 10);
+								float size = measure_text(food_cost_str, 10);
 								Vector4 food_cost = v4zw(size, 10);
 								start_of(other, &food_cost);
 								below(food_icon_dest, &food_cost);
@@ -1241,7 +4048,7 @@ void update_frame() {
 								draw_texture_v2(WORKER_ICON, xyv4(worker_icon_dest));
 
 								const char* worker_cost_str = TextFormat("-%d", 10);
-								size = MeasureText(worker_cost_str, 10);
+								size = measure_text(worker_cost_str, 10);
 								Vector4 worker_cost = v4zw(size, 10);
 								start_of(other, &worker_cost);
 								below(worker_icon_dest, &worker_cost);
@@ -1268,7 +4075,7 @@ void update_frame() {
 								draw_texture_v2(FOOD_ICON, xyv4(food_icon_dest));
 
 								const char* food_cost_str = TextFormat("-%d", state->thing_data->worker_amt);
-								float size = MeasureText(food_cost_str, 10);
+								float size = measure_text(food_cost_str, 10);
 								Vector4 food_cost = v4zw(size, 10);
 								start_of(other, &food_cost);
 								below(food_icon_dest, &food_cost);
@@ -1285,7 +4092,7 @@ void update_frame() {
 								draw_texture_v2(WORKER_ICON, xyv4(worker_icon_dest));
 
 								const char* worker_cost_str = TextFormat("+%d", state->thing_data->worker_amt / 2);
-								size = MeasureText(worker_cost_str, 10);
+								size = measure_text(worker_cost_str, 10);
 								Vector4 worker_cost = v4zw(size, 10);
 								start_of(other, &worker_cost);
 								below(worker_icon_dest, &worker_cost);
@@ -1300,6 +4107,7 @@ void update_frame() {
 
 				// :hud
 				{
+					PROFILE_ZONE("hud");
 					push_layer(L_HUD);
 					{
 						Vector4 dest = v4(0, 0, RENDER_SIZE.x, RENDER_SIZE.y);
@@ -1307,7 +4115,7 @@ void update_frame() {
 
 						ThingData data = *(ThingData*)state->player->user_data;
 						const char* foodstr = TextFormat("%d", data.food_amt);
-						float text_size = MeasureText(foodstr, 20);
+						float text_size = measure_text(foodstr, 20);
 						Vector4 food_amt = v4zw(text_size, 20);
 						end_of(food_dest, &food_amt);
 						center(food_dest, &food_amt, 1);
@@ -1318,7 +4126,7 @@ void update_frame() {
 						pad(&food_amt, LEFT, 10);
 						
 						const char* workerstr = TextFormat("%d", data.worker_amt);
-						float workker_sz = MeasureText(workerstr, 20);
+						float workker_sz = measure_text(workerstr, 20);
 						Vector4 worker_amt = v4zw(workker_sz, 20);
 						end_of(workers_dest, &worker_amt);
 						center(workers_dest, &worker_amt, 1);
@@ -1336,19 +4144,20 @@ void update_frame() {
 							pad(&skip_btn, BOTTOM, 10);
 
 							if (ui_btn(xyv4(skip_btn), "Skip..", 10)) {
-								PlaySound(ui_click);
-								state->dt_speed = 10;
+								play_sound(ui_click);
+								queue_input({INPUT_SKIP});
 							}
 							
 						}
 
+						Entity* predator = en_resolve(state->predator);
 						if(state->time_for_predator > 0) {
 						Time t = seconds_to_hm(state->time_for_predator);
 
 						char buf[1024] = {0};
 						std::snprintf(buf, 1024, "%02d:%02d:%02d", t.h, t.m, t.s);
 
-						Vector4 predators_time = v4zw((float)MeasureText(buf, 20), 20);
+						Vector4 predators_time = v4zw((float)measure_text(buf, 20), 20);
 						end_of(dest, &predators_time);
 						pad(&predators_time, TOP, 10);
 						pad(&predators_time, RIGHT, predators_time.z + 10);
@@ -1358,11 +4167,11 @@ void update_frame() {
 							color = ColorAlpha(WHITE, ((sinf(GetTime() * 3) * .5) + .5));
 
 						draw_text(xyv4(predators_time),buf, 20, color);
-						} else if(state->predator->health > 0) {
+						} else if(predator && predator->health > 0) {
 							char buf[1024] = {0};
-							std::snprintf(buf, 1024, "%04d/%d", state->predator->health, PREDATOR_HP);
+							std::snprintf(buf, 1024, "%04d/%d", predator->health, PREDATOR_HP);
 							
-							Vector4 predator_health = v4zw((float)MeasureText(buf, 20), 20);
+							Vector4 predator_health = v4zw((float)measure_text(buf, 20), 20);
 							center(dest, &predator_health, 0);
 							pad(&predator_health, TOP, 10);
 
@@ -1383,7 +4192,7 @@ void update_frame() {
 						dest.x = (RENDER_SIZE.x - dest.z) * .5f;
 						dest.y = (RENDER_SIZE.y - dest.w) * .5f;
 
-						float size = MeasureText("Welcome", 20);
+						float size = measure_text("Welcome", 20);
 						Vector4 title_dest = v4zw(size, 20);
 						start_of(dest, &title_dest);
 						center(dest, &title_dest, 0);
@@ -1419,7 +4228,7 @@ void update_frame() {
 
 						float last_y = 0.f;
 						for (int i = 0; i < message_len; i++) {
-							float message_sz = MeasureText(messages[i], 10);
+							float message_sz = measure_text(messages[i], 10);
 							Vector4 message_dest = v4zw(message_sz, 10);
 							start_of(dest, &message_dest);
 							below(title_dest, &message_dest);
@@ -1430,7 +4239,7 @@ void update_frame() {
 							last_y = message_dest.y + message_dest.w;
 						}
 						
-						size = MeasureText("Icons:", 20);
+						size = measure_text("Icons:", 20);
 						Vector4 icon_dest = v4zw(size, 20);
 						start_of(dest, &icon_dest);
 						icon_dest.y = last_y;
@@ -1446,7 +4255,7 @@ void update_frame() {
 
 						draw_texture_v2(FOOD_ICON, xyv4(icon_food));
 						
-						Vector4 icon_food_label = v4zw(float(MeasureText("Food", 10)), 10);
+						Vector4 icon_food_label = v4zw(float(measure_text("Food", 10)), 10);
 						end_of(icon_food, &icon_food_label);
 						center(icon_food, &icon_food_label, 1);
 
@@ -1459,7 +4268,7 @@ void update_frame() {
 
 						draw_texture_v2(WORKER_ICON, xyv4(icon_worker));
 
-						Vector4 icon_worker_label = v4zw((float)MeasureText("Ant", 10), 10);
+						Vector4 icon_worker_label = v4zw((float)measure_text("Ant", 10), 10);
 						start_of(icon_worker, &icon_worker_label);
 						pad(&icon_worker_label, RIGHT, icon_worker_label.z);
 						center(icon_worker, &icon_worker_label, 1);
@@ -1467,9 +4276,8 @@ void update_frame() {
 						draw_text(xyv4(icon_worker_label), "Ant", 10);
 						
 						if (ui_btn(xyv4(ok_btn), "Start", 10)) {
-							state->show_begin_message = false;
-							PlaySound(ui_click);
-							state->show_thing_ui = true;
+							play_sound(ui_click);
+							queue_input({INPUT_START});
 						}
 				}
 			}
@@ -1480,7 +4288,7 @@ void update_frame() {
 				Vector4 dest =  v4v2(ZERO, RENDER_SIZE);
 				draw_quad(dest, ColorAlpha(BLACK, .5));
 
-				Vector4 text = v4zw(float(MeasureText("You Lost...", 40)), 40);
+				Vector4 text = v4zw(float(measure_text("You Lost...", 40)), 40);
 				center(dest, &text, 0);
 				center(dest, &text, 1);
 
@@ -1491,7 +4299,7 @@ void update_frame() {
 				Vector4 dest =  v4v2(ZERO, RENDER_SIZE);
 				draw_quad(dest, ColorAlpha(BLACK, .5));
 
-				Vector4 text = v4zw(float(MeasureText("You Win!!!", 40)), 40);
+				Vector4 text = v4zw(float(measure_text("You Win!!!", 40)), 40);
 				center(dest, &text, 0);
 				center(dest, &text, 1);
 
@@ -1508,6 +4316,7 @@ void update_frame() {
 		
 		BeginDrawing();
 		{
+			PROFILE_ZONE("blit");
 			ClearBackground(BLACK);
 		
 			float scale = std::min(float(GetScreenWidth()) / RENDER_SIZE.x, float(GetScreenHeight()) / RENDER_SIZE.y);
@@ -1527,91 +4336,630 @@ void update_frame() {
 
 		
 			DrawFPS(10, WINDOW_SIZE.y - 20);
+			DrawText(TextFormat("%d draws (%d submits) / %d sprites", renderer->stats.texture_switches, renderer->stats.submissions, renderer->stats.sprites), 10, WINDOW_SIZE.y - 40, 20, LIME);
+			PROFILE_OVERLAY();
 		}
 		EndDrawing();
+		sound_flush();
+
+		if (!startup_reported) {
+			startup_reported = true;
+			double ms = std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - startup_start).count();
+			printf("startup: first frame after %.1f ms, assets took %.1f ms from %s\n",
+					ms, startup_assets_ms, bundle.data ? BUNDLE_PATH : "res/");
+		}
+}
+
+// :headless
+#define HEADLESS_TICKS (60 * 60 * 15)
+
+// Picks the next colony task the way a player clicking through the task panel would.
+void headless_pick_task() {
+	ThingData* data = state->thing_data;
+	if (data->food_amt - 200 > 0 && data->worker_amt - 10 > 0 && state->time_for_predator < 120) {
+		data->current_task = TASK_DEFENSE;
+	} else if (data->food_amt - data->worker_amt > data->worker_amt * 4) {
+		data->current_task = TASK_REPRODUCE;
+	} else {
+		data->current_task = TASK_COLLECT;
+	}
+	data->last_worker_amt = data->worker_amt;
+	state->show_thing_ui = false;
+}
+
+int run_headless(int ticks, int budget, OverflowPolicy overflow) {
+	headless = true;
+	init_state(budget, overflow);
+	state->show_begin_message = false;
+
+	auto start = std::chrono::steady_clock::now();
+	int tick = 0;
+	for (; tick < ticks; tick++) {
+		if (state->thing_data->current_task == TASK_NONE) {
+			headless_pick_task();
+		}
+		sim_tick();
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("headless: %d ticks in %.3fs (%.0f ticks/s, %.3f us/tick), %d job threads\n", tick, secs, tick / secs, secs * 1e6 / tick, jobs.thread_count);
+	printf("headless: %d live entities (%d failed spawns), food %d, workers %d, %s\n",
+			state->live_count, state->spawn_failures, state->thing_data->food_amt, state->thing_data->worker_amt,
+			state->lost ? "lost" : state->win ? "won" : "running");
+	for (int type = 0; type < ET_COUNT; type++) {
+		Pool* pool = &state->pools[type];
+		if (pool->capacity == 0) continue;
+		printf("headless: %s pool %d used / %d capacity (peak %d)\n",
+				entity_type_names[type], pool->used, pool->capacity, pool->peak);
+	}
+	return 0;
+}
+
+// Plays a recording back without a window as fast as the sim allows.
+int run_replay_headless(const char* path) {
+	headless = true;
+	if (!replay_load(path)) return 1;
+	init_state(replay.entity_budget, replay.entity_overflow);
+
+	auto start = std::chrono::steady_clock::now();
+	int ticks = 0;
+	while (!replay_finished()) {
+		ticks += sim_frame(0);
+	}
+	double secs = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+
+	printf("replay: %d ticks in %.3fs (%.0f ticks/s, %.3f us/tick), %d job threads\n",
+			ticks, secs, ticks / secs, secs * 1e6 / (ticks > 0 ? ticks : 1), jobs.thread_count);
+	return replay_verify() ? 0 : 1;
+}
+
+// :bench
+typedef void (*BenchFn)();
+
+double bench_now() {
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// The entity layout before the hot/cold split, kept only so bench_layout
+// can compare against it.
+struct AosEntity {
+	int handle;
+	unsigned generation;
+	Vector2 pos, vel, size, remainder;
+	EntityId id;
+	EntityType type;
+	struct {
+		EntityProp *items;
+		int count;
+		int capacity;
+	} props;
+	bool valid;
+	bool grounded;
+	AosEntity* last_collided;
+	rawptr user_data;
+	float facing;
+	AosEntity* riding;
+	bool trigger;
+	bool was_selected;
+	int health;
+	bool attacked;
+};
+
+// Times the two whole-world passes every frame makes: the render walk
+// (type + position of every live entity) and the unselected-flower gather,
+// once over the old by-value Entity array and once over the split storage.
+void bench_layout() {
+	int sizes[] = {2000, 20000, 200000};
+	for (int n : sizes) {
+		arena_free(&arena);
+		alloc_state(n, OVERFLOW_GROW);
+		AosEntity* aos = (AosEntity*)arena_alloc(&arena, sizeof(AosEntity) * n);
+		memset(aos, 0, sizeof(AosEntity) * n);
+
+		SetRandomSeed(n);
+		for (int i = 0; i < n; i++) {
+			int roll = GetRandomValue(0, 99);
+			if (roll < 10) continue;
+			EntityType type = roll < 85 ? ET_FLOWER : roll < 95 ? ET_WORKER : ET_FIREBALL;
+			Vector2 pos = v2(GetRandomValue(-320, 320), GetRandomValue(-180, 180));
+			Entity* en = new_en();
+			en_setup(en, pos, v2of(16), type);
+			en->was_selected = roll < 40;
+			aos[en->handle].pos = pos;
+			aos[en->handle].size = v2of(16);
+			aos[en->handle].type = type;
+			aos[en->handle].valid = true;
+			aos[en->handle].was_selected = roll < 40;
+		}
+
+		int reps = std::max(1, 20000000 / n);
+		float sink = 0;
+		int flowers = 0;
+		// Best of three runs per pass, in ns per slot.
+		double aos_render = 1e9, soa_render = 1e9, aos_gather = 1e9, soa_gather = 1e9;
+
+		for (int run = 0; run < 3; run++) {
+			double start = bench_now();
+			for (int r = 0; r < reps; r++) {
+				for (int i = 0; i < n; i++) {
+					AosEntity en = aos[i];
+					if (!en.valid) continue;
+					sink += en.pos.x + en.pos.y * float(en.type);
+				}
+			}
+			aos_render = std::min(aos_render, (bench_now() - start) * 1e9 / (double(reps) * n));
+
+			start = bench_now();
+			for (int r = 0; r < reps; r++) {
+				for (int i = 0; i < n; i++) {
+					AosEntity en = aos[i];
+					if (en.valid && en.type == ET_FLOWER && !en.was_selected) flowers += 1;
+				}
+			}
+			aos_gather = std::min(aos_gather, (bench_now() - start) * 1e9 / (double(reps) * n));
+
+			start = bench_now();
+			for (int r = 0; r < reps; r++) {
+				// Same walk as the entities render pass.
+				const uint8_t* types = state->type;
+				for (int i = 0; i < state->entity_cap; i++) {
+					if (types[i] == ET_NONE) continue;
+					sink += state->pos[i].x + state->pos[i].y * float(types[i]);
+				}
+			}
+			soa_render = std::min(soa_render, (bench_now() - start) * 1e9 / (double(reps) * n));
 
+			start = bench_now();
+			for (int r = 0; r < reps; r++) {
+				for (int i : en_all()) {
+					if (state->type[i] == ET_FLOWER && !en_at(i)->was_selected) flowers += 1;
+				}
+			}
+			soa_gather = std::min(soa_gather, (bench_now() - start) * 1e9 / (double(reps) * n));
+		}
+
+		printf("{\"bench\": \"layout\", \"entities\": %d, \"render_aos_ns\": %.3f, \"render_soa_ns\": %.3f, \"gather_aos_ns\": %.3f, \"gather_soa_ns\": %.3f, \"sink\": %d}\n",
+				n, aos_render, soa_render, aos_gather, soa_gather, int(sink) ^ flowers);
+	}
+}
+
+// Expands atlas sprites into the vertex stream the way flush_layer does,
+// without touching rlgl.
+void bench_batch() {
+	arena_free(&arena);
+	SpriteBatch batch = {};
+	batch.tex.width = 1024;
+	batch.tex.height = 1024;
+
+	int quads = 100000;
+	int reps = 50;
+	double best = 1e9;
+	for (int r = 0; r < reps; r++) {
+		batch.count = 0;
+		double start = bench_now();
+		for (int i = 0; i < quads; i++) {
+			batch_push_quad(&batch, FLOWER_0, v4(float(i % 640), float(i % 360), FLOWER_0.z, FLOWER_0.w), WHITE);
+		}
+		best = std::min(best, (bench_now() - start) * 1e9 / quads);
+	}
+
+	SpriteVertex v = batch.items[2];
+	bool uv_ok = v.u == (FLOWER_0.x + FLOWER_0.z) / 1024.f && v.v == (FLOWER_0.y + FLOWER_0.w) / 1024.f;
+	printf("{\"bench\": \"batch\", \"quads\": %d, \"ns_per_quad\": %.3f, \"vertices\": %d, \"uv_ok\": %s}\n",
+			quads, best, batch.count, uv_ok ? "true" : "false");
+}
+
+// Sorts a frame's worth of render keys spread over a few layers and a
+// range of y depths, and checks the result against std::sort.
+void bench_sort() {
+	arena_free(&arena);
+	int count = 100000;
+	uint64_t* src = (uint64_t*)arena_alloc(&arena, sizeof(uint64_t) * count);
+	uint64_t* keys = (uint64_t*)arena_alloc(&arena, sizeof(uint64_t) * count);
+	uint64_t* tmp = (uint64_t*)arena_alloc(&arena, sizeof(uint64_t) * count);
+
+	SetRandomSeed(1);
+	for (int i = 0; i < count; i++) {
+		uint64_t layer = GetRandomValue(L_BACK, L_HUD);
+		uint64_t depth = layer == L_DEBUG_COL ? y_depth(GetRandomValue(-180, 180)) : 0;
+		src[i] = layer << KEY_LAYER_SHIFT | depth << KEY_DEPTH_SHIFT | uint64_t(i);
+	}
+
+	double best = 1e9;
+	for (int r = 0; r < 20; r++) {
+		memcpy(keys, src, sizeof(uint64_t) * count);
+		double start = bench_now();
+		radix_sort_keys(keys, tmp, count);
+		best = std::min(best, (bench_now() - start) * 1e9 / count);
+	}
+
+	memcpy(tmp, src, sizeof(uint64_t) * count);
+	std::sort(tmp, tmp + count);
+	bool sorted = memcmp(tmp, keys, sizeof(uint64_t) * count) == 0;
+	printf("{\"bench\": \"sort\", \"keys\": %d, \"ns_per_key\": %.3f, \"sorted\": %s}\n",
+			count, best, sorted ? "true" : "false");
+}
+
+void bench_move() {
+	arena_free(&arena);
+	int count = 100000;
+	Vector2* start_pos = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * count);
+	Vector2* target = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * count);
+	float* max_dist = (float*)arena_alloc(&arena, sizeof(float) * count);
+	Vector2* scalar = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * count);
+	Vector2* batch = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * count);
+	bool* scalar_arrived = (bool*)arena_alloc(&arena, sizeof(bool) * count);
+	uint64_t* arrived = (uint64_t*)arena_alloc(&arena, sizeof(uint64_t) * ((count + 63) / 64));
+
+	SetRandomSeed(1);
+	for (int i = 0; i < count; i++) {
+		start_pos[i] = v2(GetRandomValue(-320, 320), GetRandomValue(-180, 180));
+		// A few percent land on their target this step.
+		target[i] = start_pos[i] + v2(GetRandomValue(-16, 16), GetRandomValue(-16, 16));
+		max_dist[i] = GetRandomValue(0, 1) ? 100 * SIM_DT : 200 * SIM_DT;
+	}
+
+	int reps = 50;
+	double best_scalar = 1e9;
+	double best_batch = 1e9;
+	for (int r = 0; r < reps; r++) {
+		memcpy(scalar, start_pos, sizeof(Vector2) * count);
+		double start = bench_now();
+		for (int i = 0; i < count; i++) {
+			scalar[i] = Vector2MoveTowards(scalar[i], target[i], max_dist[i]);
+			scalar_arrived[i] = Vector2Equals(scalar[i], target[i]);
+		}
+		best_scalar = std::min(best_scalar, (bench_now() - start) * 1e9 / count);
+
+		memcpy(batch, start_pos, sizeof(Vector2) * count);
+		start = bench_now();
+		move_towards_batch(batch, target, max_dist, count, arrived);
+		best_batch = std::min(best_batch, (bench_now() - start) * 1e9 / count);
+	}
+
+	bool match = memcmp(scalar, batch, sizeof(Vector2) * count) == 0;
+	int landed = 0;
+	for (int i = 0; i < count; i++) {
+		bool bit = (arrived[i >> 6] >> (i & 63)) & 1;
+		match = match && bit == scalar_arrived[i];
+		landed += bit;
+	}
+	printf("{\"bench\": \"move\", \"entities\": %d, \"path\": \"%s\", \"scalar_ns\": %.3f, \"batch_ns\": %.3f, \"arrived\": %d, \"match\": %s}\n",
+			count, MOVE_TOWARDS_PATH, best_scalar, best_batch, landed, match ? "true" : "false");
+}
+
+// :scenarios
+// Whole-sim stress runs. Each scenario starts from init_state with a fixed
+// seed, adds its entities with the usual constructors and runs a fixed
+// number of ticks with the headless task picker, timing every tick.
+struct Scenario {
+	const char* name;
+	// Entity budget the world starts with.
+	int budget;
+	int ticks;
+	void (*setup)();
+	// Runs before every tick, if set.
+	void (*tick)();
+};
+
+size_t arena_bytes(Arena* a) {
+	size_t bytes = 0;
+	for (Region* r = a->begin; r != NULL; r = r->next) {
+		bytes += r->count * sizeof(uintptr_t);
+	}
+	return bytes;
+}
+
+// Everything the sim has allocated: the main and temp arenas plus the
+// per-job command buffers.
+size_t sim_arena_bytes() {
+	size_t bytes = arena_bytes(&arena) + arena_bytes(&temp_arena);
+	for (int job = 0; job < sim_jobs.buffer_count; job++) {
+		bytes += arena_bytes(&sim_jobs.buffers[job].arena);
+	}
+	return bytes;
+}
+
+void scenario_random_points(Vector2* out, int count) {
+	rng_fill_points(&state->rng[RNG_SPAWN], out, count, SPAWN_AREA);
+}
+
+// Today's game: the starting flowers and the colony's own workers.
+void scenario_game_setup() {
+}
+
+void scenario_swarm_setup() {
+	Vector2* pos = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * 10000);
+	scenario_random_points(pos, 10000);
+	for (int i = 0; i < 10000; i++) {
+		en_flower(pos[i]);
+	}
+	state->flower_cnt += 10000;
+	scenario_random_points(pos, 5000);
+	for (int i = 0; i < 5000; i++) {
+		en_worker(pos[i], TASK_COLLECT);
+	}
+}
+
+void scenario_siege_setup() {
+	Vector2 pos[50];
+	scenario_random_points(pos, 50);
+	for (Vector2 p : pos) {
+		en_defense(p, v2(DEFENSE_BUILDING.z, DEFENSE_BUILDING.w));
+	}
+	state->predator = en_handle(en_predator(v2(0, -RENDER_SIZE.y / 2), v2(PREDATOR.z, PREDATOR.w)));
+	in_predator = true;
+}
+
+// Keeps the predator alive so all defenses fire for the whole run.
+void scenario_siege_tick() {
+	Entity* predator = en_resolve(state->predator);
+	if (predator) predator->health = PREDATOR_HP;
+}
+
+// Far past the default budget: the slot storage grows on the way up.
+void scenario_colony_setup() {
+	Vector2* pos = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * 100000);
+	scenario_random_points(pos, 100000);
+	for (int i = 0; i < 100000; i++) {
+		en_flower(pos[i]);
+	}
+	state->flower_cnt += 100000;
+	scenario_random_points(pos, 20000);
+	for (int i = 0; i < 20000; i++) {
+		en_worker(pos[i], TASK_COLLECT);
+	}
+}
+
+#define CHURN_PER_TICK 1024
+
+// Every tick frees CHURN_PER_TICK random flowers and spawns as many, so the
+// free list, indices and grid see the worst turnover the slots allow. The
+// world is filled up to a little headroom for the colony's own spawns.
+void scenario_churn_setup() {
+	Vector2* pos = (Vector2*)arena_alloc(&arena, sizeof(Vector2) * state->entity_cap);
+	int count = state->free_count - 2 * CHURN_PER_TICK;
+	scenario_random_points(pos, count);
+	for (int i = 0; i < count; i++) {
+		en_flower(pos[i]);
+	}
+	state->flower_cnt += count;
+}
+
+void scenario_churn_tick() {
+	Rng* rng = &state->rng[RNG_SPAWN];
+	SparseSet* flowers = &state->type_index[ET_FLOWER];
+	for (int i = 0; i < CHURN_PER_TICK && flowers->count > 0; i++) {
+		en_invalidate(en_at(flowers->dense[rng_range(rng, 0, flowers->count - 1)]));
+	}
+	Vector2 pos[CHURN_PER_TICK];
+	rng_fill_points(rng, pos, CHURN_PER_TICK, SPAWN_AREA);
+	for (Vector2 p : pos) {
+		en_flower(p);
+	}
+}
+
+Scenario scenarios[] = {
+	{"game", ENTITY_BUDGET, 3600, scenario_game_setup, nullptr},
+	{"swarm", 16384, 600, scenario_swarm_setup, nullptr},
+	{"siege", ENTITY_BUDGET, 1800, scenario_siege_setup, scenario_siege_tick},
+	{"churn", 16384, 1800, scenario_churn_setup, scenario_churn_tick},
+	{"colony", ENTITY_BUDGET, 300, scenario_colony_setup, nullptr},
+};
+
+// A fresh world with a fixed seed. Anything still pointing into the arena
+// from the last run goes too.
+void scenario_begin(Scenario scenario) {
+	for (int job = 0; job < sim_jobs.buffer_count; job++) {
+		arena_free(&sim_jobs.buffers[job].arena);
+	}
+	sim_jobs = {};
+	arena_free(&arena);
+	arena_free(&temp_arena);
+	in_predator = false;
+	session_seed = 1;
+	init_state(scenario.budget, OVERFLOW_GROW);
+	state->show_begin_message = false;
+	scenario.setup();
+}
+
+void scenario_step() {
+	if (state->thing_data->current_task == TASK_NONE) {
+		headless_pick_task();
+	}
+	sim_tick();
+}
+
+void bench_scenarios() {
+	for (Scenario scenario : scenarios) {
+		scenario_begin(scenario);
+		int live_start = state->live_count;
+
+		double* tick_ns = (double*)arena_alloc(&arena, sizeof(double) * scenario.ticks);
+		size_t peak_bytes = 0;
+		double total = 0;
+		for (int t = 0; t < scenario.ticks; t++) {
+			double start = bench_now();
+			if (scenario.tick) scenario.tick();
+			scenario_step();
+			tick_ns[t] = (bench_now() - start) * 1e9;
+			total += tick_ns[t];
+			peak_bytes = std::max(peak_bytes, sim_arena_bytes());
+		}
+
+		int p99 = std::min(scenario.ticks - 1, scenario.ticks * 99 / 100);
+		std::nth_element(tick_ns, tick_ns + p99, tick_ns + scenario.ticks);
+		printf("{\"bench\": \"scenario\", \"name\": \"%s\", \"ticks\": %d, \"live_start\": %d, \"live_end\": %d, \"ns_per_tick\": %.0f, \"p99_ns\": %.0f, \"peak_arena_bytes\": %zu}\n",
+				scenario.name, scenario.ticks, live_start, state->live_count, total / scenario.ticks, tick_ns[p99], peak_bytes);
+	}
+}
+
+// Saves and loads the colony scenario's 120k entities, then checks the
+// loaded session plays on exactly like the saved one.
+void bench_snapshot() {
+	Scenario colony = {"colony", ENTITY_BUDGET, 0, scenario_colony_setup, nullptr};
+	scenario_begin(colony);
+	for (int t = 0; t < 10; t++) scenario_step();
+	const char* path = "bench_snapshot.bin";
+	int live = state->live_count;
+	uint64_t saved_checksum = state_checksum();
+
+	int reps = 10;
+	double write_ms = 1e9, save_ms = 1e9, load_ms = 1e9;
+	size_t size = snapshot_write(NULL);
+	uint8_t* buffer = (uint8_t*)arena_alloc(&arena, size);
+	for (int r = 0; r < reps; r++) {
+		double start = bench_now();
+		snapshot_write(buffer);
+		write_ms = std::min(write_ms, (bench_now() - start) * 1e3);
+		start = bench_now();
+		snapshot_save(path);
+		save_ms = std::min(save_ms, (bench_now() - start) * 1e3);
+	}
+
+	for (int t = 0; t < 100; t++) scenario_step();
+	uint64_t expected = state_checksum();
+
+	bool loaded = true;
+	for (int r = 0; r < reps; r++) {
+		double start = bench_now();
+		loaded = loaded && snapshot_load(path);
+		load_ms = std::min(load_ms, (bench_now() - start) * 1e3);
+	}
+	bool restored = loaded && state_checksum() == saved_checksum;
+	for (int t = 0; t < 100; t++) scenario_step();
+	bool match = restored && state_checksum() == expected;
+	remove(path);
+
+	printf("{\"bench\": \"snapshot\", \"entities\": %d, \"bytes\": %zu, \"write_ms\": %.3f, \"save_ms\": %.3f, \"load_ms\": %.3f, \"match\": %s}\n",
+			live, size, write_ms, save_ms, load_ms, match ? "true" : "false");
+}
+
+struct Bench {
+	const char* name;
+	BenchFn fn;
+};
+
+Bench benches[] = {
+	{"layout", bench_layout},
+	{"batch", bench_batch},
+	{"sort", bench_sort},
+	{"move", bench_move},
+	{"scenarios", bench_scenarios},
+	{"snapshot", bench_snapshot},
+};
+
+int run_bench(const char* name) {
+	headless = true;
+	int ran = 0;
+	for (Bench bench : benches) {
+		if (name == nullptr || strcmp(name, bench.name) == 0) {
+			bench.fn();
+			ran += 1;
+		}
+	}
+	if (ran == 0) {
+		fprintf(stderr, "unknown bench '%s'\n", name);
+		return 1;
+	}
+	return 0;
 }
 
-int main(void) {
+int main(int argc, char** argv) {
+	startup_start = std::chrono::steady_clock::now();
+	jobs_init();
+
+	bool headless_run = false;
+	int headless_ticks = HEADLESS_TICKS;
+	bool seeded = false;
+	bool use_bundle = true;
+	int entity_budget = ENTITY_BUDGET;
+	OverflowPolicy entity_overflow = OVERFLOW_GROW;
+	for (int i = 1; i < argc; i++) {
+		if (strcmp(argv[i], "--headless") == 0) {
+			headless_run = true;
+			int ticks = i + 1 < argc ? atoi(argv[i + 1]) : 0;
+			if (ticks > 0) headless_ticks = ticks, i++;
+		} else if (strcmp(argv[i], "--bench") == 0) {
+			return run_bench(i + 1 < argc ? argv[i + 1] : nullptr);
+		} else if (strcmp(argv[i], "--pack") == 0) {
+			bool has_path = i + 1 < argc && strncmp(argv[i + 1], "--", 2) != 0;
+			return run_pack(has_path ? argv[i + 1] : BUNDLE_PATH);
+		} else if (strcmp(argv[i], "--no-bundle") == 0) {
+			use_bundle = false;
+		} else if (strcmp(argv[i], "--entity-budget") == 0 && i + 1 < argc) {
+			entity_budget = std::max(1, atoi(argv[++i]));
+		} else if (strcmp(argv[i], "--overflow") == 0 && i + 1 < argc) {
+			const char* policy = argv[++i];
+			if (strcmp(policy, "refuse") == 0) entity_overflow = OVERFLOW_REFUSE;
+			else if (strcmp(policy, "evict") == 0) entity_overflow = OVERFLOW_EVICT_FIREBALL;
+			else if (strcmp(policy, "grow") == 0) entity_overflow = OVERFLOW_GROW;
+			else fprintf(stderr, "unknown overflow policy '%s', expected refuse, evict or grow\n", policy);
+		} else if (strcmp(argv[i], "--seed") == 0 && i + 1 < argc) {
+			session_seed = strtoull(argv[++i], NULL, 10);
+			seeded = true;
+		} else if (strcmp(argv[i], "--record") == 0 && i + 1 < argc) {
+			replay.mode = REPLAY_RECORD;
+			replay.path = argv[++i];
+		} else if (strcmp(argv[i], "--replay") == 0 && i + 1 < argc) {
+			replay.mode = REPLAY_PLAY;
+			replay.path = argv[++i];
+		}
+	}
+	if (replay.mode == REPLAY_PLAY) {
+		if (headless_run) return run_replay_headless(replay.path);
+		if (!replay_load(replay.path)) return 1;
+		entity_budget = replay.entity_budget;
+		entity_overflow = replay.entity_overflow;
+	} else if (headless_run) {
+		return run_headless(headless_ticks, entity_budget, entity_overflow);
+	}
+	// Headless runs keep the fixed default so they are comparable, and
+	// playback keeps the seed replay_load restored from the header.
+	if (!seeded && replay.mode != REPLAY_PLAY) {
+		session_seed = uint64_t(time(NULL));
+	}
+	init_state(entity_budget, entity_overflow);
 
 	// :raylib
 	SetTraceLogLevel(LOG_WARNING);
 	InitWindow(WINDOW_SIZE.x, WINDOW_SIZE.y, "ld56");
 	InitAudioDevice();
-	SetTargetFPS(60);
+	// Playback runs unthrottled; the recorded dts decide how far each frame steps.
+	SetTargetFPS(replay.mode == REPLAY_PLAY ? 0 : 60);
 	SetExitKey(KEY_Q);
 	
 	// :load
-	Texture2D atlas = LoadTexture("./res/atlas.png");
+	// Assets load in the background; update_frame shows a loading screen
+	// and calls start_game once they are in.
+	if (use_bundle) bundle_open(BUNDLE_PATH);
+	queue_game_assets();
+	loader_start();
 	game_texture = LoadRenderTexture(RENDER_SIZE.x, RENDER_SIZE.y);
 	light_texture = LoadRenderTexture(RENDER_SIZE.x, RENDER_SIZE.y);
 	ui_texture = LoadRenderTexture(RENDER_SIZE.x, RENDER_SIZE.y);
-	ui_click = LoadSound("./res/btn_click.wav");
-	loop_1 = LoadMusicStream("./res/loop_1.ogg");
-	predator_music = LoadMusicStream("./res/predator.ogg");
-	Sound remove_flower = LoadSound("./res/remove_flower.wav");
-	hover_sound = LoadSound("./res/hover.wav");
-	Sound shoot = LoadSound("./res/shoot.wav");
-	Sound died = LoadSound("./res/died.wav");
-
-	// :init
-	renderer = (Renderer*)arena_alloc(&arena, sizeof(Renderer));
-	memset(renderer->layers, 0, sizeof(RenderLayer) * MAX_LAYERS);
-	renderer->layer_stack = {0};
-	renderer->current_layer = 0;
-	renderer->atlas = atlas;
-	
-	state = (State*)arena_alloc(&arena, sizeof(State));
-	memset(state->entities, 0, sizeof(Entity) * MAX_ENTITIES);
-	state->dt_speed = 1;	
-	state->cam = Camera2D{};
-	state->cam.zoom = 1.f;
-	state->cam.offset = RENDER_SIZE / v2of(2);
-	state->show_begin_message = true;
-	state->time_for_predator = 600;
-	state->remove_flower = remove_flower;
-	state->shoot = shoot;
-	state->died = died;
-	state->lost = false;
-	state->win = false;
-
-	Vector2 player_size = v2(48, 64);
-	player_pos = ZERO - (player_size / 2);
-	state->player = en_thing(player_pos, player_size);
-	state->thing_data = (ThingData*)state->player->user_data; 
-
-	assert(renderer != NULL && "arena returned null");
 
-	flower_spawn_time = .8;
-	
-	for (int i = 0; i < 256; i++) {
-		Vector2 pos = v2(
-			GetRandomValue(-RENDER_SIZE.x/2, RENDER_SIZE.x/2),
-			GetRandomValue(-RENDER_SIZE.y/2, RENDER_SIZE.y/2)
-		);
-			
-		bool in_player = CheckCollisionPointRec(pos, to_rect(v4v2(player_pos, v2(48, 64))));
-		bool out_of_bounds = pos.x + 16 > RENDER_SIZE.x / 2 || pos.x < -RENDER_SIZE.x / 2 || pos.y + 16 > RENDER_SIZE.x / 2 || pos.y < -RENDER_SIZE.x / 2;
-		if(!in_player && !out_of_bounds) {
-			en_flower(pos);
-		}
-	}
-	state->flower_cnt = 256;
-
-	Music music = loop_1;
-	PlayMusicStream(music);
-
-	float volume = 0;
-	bool in_predator = false;
 #if defined(PLATFORM_WEB)
     emscripten_set_main_loop(update_frame, 60, 1);
 #else
-    while (!WindowShouldClose()) {
+    while (!WindowShouldClose() && !replay_finished()) {
     	update_frame();
 	}
 #endif
 
+	// Closed while still loading.
+	if (loader.thread.joinable()) {
+		loader.thread.join();
+	}
+
+	int status = 0;
+	if (replay.mode == REPLAY_RECORD) {
+		status = replay_save() ? 0 : 1;
+	} else if (replay.mode == REPLAY_PLAY) {
+		status = replay_finished() && replay_verify() ? 0 : 1;
+	}
+
 	CloseWindow();
 
-	return 0;
+	return status;
 }